@@ -0,0 +1,89 @@
+#ifndef __BLOCKINDEX_HH
+#define __BLOCKINDEX_HH
+
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include <TObject.h>
+
+// One entry for every block in a MIDAS file. Timestamps are the raw
+// FEBEX timestamps, i.e. before any time offset from the calibration.
+struct BlockIndexEntry {
+
+	ULong64_t offset;			///< byte offset of the block in the file
+	UInt_t header_sequence;		///< sequence number from the block header
+	UInt_t flags;				///< see BlockIndex::flag_t
+	ULong64_t time_first;		///< earliest hit timestamp in the block
+	ULong64_t time_last;		///< latest hit timestamp in the block
+	ULong64_t tm_stp_msb;		///< timestamp MSB at the start of the block
+	ULong64_t tm_stp_hsb;		///< timestamp HSB at the start of the block
+
+};
+
+// Index of the blocks in a MIDAS file, kept in a sidecar file next to
+// the data file, i.e. R123_0.idx for R123_0. It is used to convert just a
+// time window or a few boards of a file without reading it all.
+class BlockIndex {
+
+public:
+
+	BlockIndex( unsigned int nsfp, unsigned int nboard );
+	~BlockIndex() {};
+
+	// Flags for each block
+	enum flag_t {
+		BLOCK_GOOD = 1,		// header and terminator were both fine
+		BLOCK_HITS = 2,		// there is at least one hit in the block
+		BLOCK_SYNC = 4		// the timestamp MSB is set before the first hit
+	};
+
+	void Clear();
+	void AddBlock( const BlockIndexEntry &entry, const std::vector<UInt_t> &hits );
+
+	bool ReadIndex( std::string index_file_name );
+	bool WriteIndex( std::string index_file_name );
+
+	// The index belongs to a file of this size and modification time
+	inline void SetInputFile( unsigned long long size, long long mtime ){
+		file_size = size;
+		file_mtime = mtime;
+	};
+	inline bool IsValidFor( unsigned long long size, long long mtime ){
+		return size == file_size && mtime == file_mtime && IsComplete();
+	};
+	inline bool IsComplete(){
+		return entries.size() == file_size / block_size;
+	};
+	inline void SetBlockSize( unsigned long long bs ){ block_size = bs; };
+	inline unsigned long long GetBlockSize(){ return block_size; };
+
+	static inline std::string GetIndexFileName( std::string input_file_name ){
+		return input_file_name + ".idx";
+	};
+
+	inline unsigned long GetNumberOfBlocks(){ return entries.size(); };
+	inline BlockIndexEntry& GetEntry( unsigned long nblock ){ return entries.at(nblock); };
+	inline UInt_t GetHits( unsigned long nblock, unsigned char sfp, unsigned char board ){
+		if( sfp >= n_sfp || board >= n_board ) return 0;
+		return hits.at( ( nblock * n_sfp + sfp ) * n_board + board );
+	};
+
+	bool FindTimeWindow( ULong64_t tmin, ULong64_t tmax,
+						unsigned long &first_block, unsigned long &last_block );
+
+
+private:
+
+	unsigned int n_sfp, n_board;			///< size of the hit counters
+	unsigned long long block_size;			///< size of each block in bytes
+	unsigned long long file_size;			///< size of the indexed file
+	long long file_mtime;					///< modification time of the indexed file
+
+	std::vector<BlockIndexEntry> entries;	///< one entry per block
+	std::vector<UInt_t> hits;				///< hits per block, SFP and board
+
+};
+
+#endif
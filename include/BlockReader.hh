@@ -0,0 +1,73 @@
+#ifndef __BLOCKREADER_HH
+#define __BLOCKREADER_HH
+
+#include <condition_variable>
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+// Reads data blocks ahead of the decoding, on its own thread, in to a
+// ring of block buffers. The converter then finds the next block already
+// in memory instead of waiting for every read, which matters on network
+// storage where the latency of each read is the limit, not the CPU.
+// Regular files are read with pread, so blocks picked out by the block
+// index cost no seeking. Anything else is read as a stream.
+class BlockReader {
+
+public:
+
+	BlockReader();
+	~BlockReader();
+
+	// Read from first_block up to, but not including, last_block, or until
+	// the end of a stream if last_block is 0. If blocks is not empty, read
+	// just those blocks, in that order.
+	bool Open( std::string input_file_name, unsigned int block_size,
+			  unsigned int nbuffers, unsigned long first_block,
+			  unsigned long last_block,
+			  const std::vector<unsigned long> &blocks = std::vector<unsigned long>() );
+	void Close();
+
+	// Next block, or nullptr at the end. It stays valid until it is
+	// released, which is done oldest first.
+	const char* Next( unsigned long &nblock );
+	void Release();
+
+
+private:
+
+	// Background thread that fills the ring
+	void ReadBlocks();
+	bool ReadBlock( char *data, unsigned long nblock );
+
+	int fd;									//!
+	bool flag_stream;						//! read with read() rather than pread()
+	std::string file_name;					//!
+	unsigned int block_size;				//!
+
+	unsigned long first_block;				//!
+	unsigned long last_block;				//!
+	std::vector<unsigned long> block_list;	//! blocks to read, all of them if empty
+
+	std::thread worker;						//!
+	std::mutex ring_lock;					//!
+	std::condition_variable block_ready;	//! a block was read, or we're done
+	std::condition_variable block_free;		//! there's space for another block
+	std::vector<char> ring;					//! buffers for nbuffers blocks
+	std::vector<unsigned long> ring_block;	//! block number in each buffer
+	unsigned int nbuffers;					//!
+	unsigned long long nread;				//! blocks read by the thread
+	unsigned long long ntaken;				//! blocks given to the reader
+	unsigned long long nreleased;			//! blocks given back by the reader
+	bool flag_done;							//! no more blocks are coming
+	bool flag_stop;							//! reader is closing, so stop early
+
+};
+
+#endif
@@ -7,6 +7,8 @@
 #include <fstream>
 #include <string>
 #include <array>
+#include <atomic>
+#include <cstdint>
 #include <cstdlib>
 
 #include "TSystem.h"
@@ -20,6 +22,8 @@
 # include "Settings.hh"
 #endif
 
+class ConfigCache;
+
 
 class FebexMWD : public TObject {
 	
@@ -32,8 +36,15 @@ public:
 	// Main algorithm
 	void DoMWD(std::string trace_name);
 	
+	// Forget the last trace
+	inline void Clear( Option_t * = "" ){
+		trace.clear();
+		energy_list.clear();
+		cfd_list.clear();
+	};
+	
 	// Set functions
-	inline void SetTrace( std::vector<unsigned short> t ){ trace = t; };
+	inline void SetTrace( const std::vector<unsigned short> &t ){ trace.assign( t.begin(), t.end() ); };
 	inline void SetRiseTime( unsigned int t ){ rise_time = t; };
 	inline void SetDecayTime( float t ){ decay_time = t; };
 	inline void SetFlatTop( unsigned int t ){ flat_top = t; };
@@ -119,6 +130,154 @@ private:
 };
 
 
+/// The same MWD and CFD as FebexMWD, but for many traces of one channel at
+/// once, all with the same length. They are done FebexMWDBatch::lanes traces
+/// at a time, stored sample by sample with one value for each trace next to
+/// each other, i.e. structure of arrays. Each stage then runs across the
+/// traces together, which the compiler can do in SIMD lanes, and it's all
+/// small enough to stay in the cache. Meant for going over the traces in a
+/// sorted file again.
+class FebexMWDBatch : public TObject {
+	
+public:
+	
+	// Constructor/destructor
+	inline FebexMWDBatch() : ntraces(0), trace_length(0) {};
+	virtual inline ~FebexMWDBatch() {};
+	
+	// Start a new batch of traces with this many samples each
+	void Reset( unsigned int length );
+	
+	// Add a trace to the batch, false if it's the wrong length
+	bool AddTrace( const std::vector<unsigned short> &t );
+	
+	// Main algorithm, over all traces in the batch
+	void DoMWD();
+	
+	// Number of traces that go through the stages together
+	static const unsigned int lanes = 8;
+	
+	// Set functions
+	inline void SetRiseTime( unsigned int t ){ rise_time = t; };
+	inline void SetDecayTime( float t ){ decay_time = t; };
+	inline void SetFlatTop( unsigned int t ){ flat_top = t; };
+	inline void SetWindow( unsigned int t ){ window = t; };
+	inline void SetDelayTime( unsigned int t ){ delay_time = t; };
+	inline void SetThreshold( unsigned int t ){ threshold = t; };
+	inline void SetFraction( float f ){ fraction = f; };
+	
+	// Get functions
+	inline unsigned int GetTraceLength(){ return trace_length; };
+	inline unsigned int NumberOfTraces(){ return ntraces; };
+	inline unsigned int NumberOfTriggers( unsigned int t ){
+		if( t + 1 < first_trigger.size() ) return first_trigger[t+1] - first_trigger[t];
+		else return 0;
+	};
+	inline float GetEnergy( unsigned int t, unsigned int i ){
+		if( i < NumberOfTriggers(t) ) return energy_list[ first_trigger[t] + i ];
+		else return -99.9;
+	};
+	inline float GetCfdTime( unsigned int t, unsigned int i ){
+		if( i < NumberOfTriggers(t) ) return cfd_list[ first_trigger[t] + i ];
+		else return 0;
+	};
+	
+	// Everything in one go, trace by trace. The triggers of trace t
+	// start at GetFirstTriggers()[t] and stop before GetFirstTriggers()[t+1]
+	inline const std::vector<float>& GetEnergies(){ return energy_list; };
+	inline const std::vector<float>& GetCfdTimes(){ return cfd_list; };
+	inline const std::vector<unsigned int>& GetFirstTriggers(){ return first_trigger; };
+	
+private:
+	
+	// Stages for the traces in the lanes, then the triggers of one of them
+	void DoStages();
+	void FindTriggers( unsigned int l );
+	
+	// Number and length of the traces
+	unsigned int ntraces, trace_length;
+	
+	// Samples as they were added, one trace after another
+	std::vector<unsigned short> input;	//!
+	
+	// Samples and stages of the traces in the lanes, index [sample*lanes + lane]
+	std::vector<float> trace;			//!
+	std::vector<float> stage1;			//!
+	std::vector<float> stage2;			//!
+	std::vector<float> stage3;			//!
+	std::vector<float> shaper;			//!
+	std::vector<float> cfd;				//!
+	
+	// Energies and times of all traces, see GetFirstTriggers()
+	std::vector<float> energy_list;			//!
+	std::vector<float> cfd_list;			//!
+	std::vector<unsigned int> first_trigger;	//!
+	
+	// Values of MWD
+	unsigned int rise_time, flat_top, window;
+	float decay_time;
+	
+	// Values for CFD
+	unsigned int delay_time;
+	int threshold;
+	float fraction;
+	
+	ClassDef( FebexMWDBatch, 1 );
+	
+};
+
+
+/// All of the calibration of one FEBEX channel, kept together in one cache
+/// line. Calibration has one for each channel in a flat table, so a hit
+/// only ever needs one of them.
+struct alignas(64) FebexChannelCal {
+	
+	float offset;			///< energy, constant term
+	float gain;				///< energy, linear term
+	float gain_quadr;		///< energy, quadratic term
+	bool is_default;		///< energy not calibrated, so the raw value is used as it is
+	float threshold;		///< threshold on the raw value
+	long time;				///< time offset
+	float mwd_decay;		///< MWD decay time
+	unsigned int mwd_rise;	///< MWD rise time
+	unsigned int mwd_top;	///< MWD flat top
+	unsigned int mwd_window;	///< MWD averaging window
+	unsigned int cfd_delay;	///< CFD delay time
+	int cfd_threshold;		///< CFD threshold, a negative threshold for negative pulses
+	float cfd_fraction;		///< CFD fraction
+	
+};
+
+/// Uniform random numbers for dithering the ADC values. It's xoshiro128+,
+/// which is much quicker than TRandom and is small enough for each thread
+/// to have its own, see Calibration::Dither().
+class DitherRandom {
+	
+public:
+	
+	DitherRandom( unsigned long long seed );
+	~DitherRandom() {};
+	
+	// Uniform in [0,1), from the top 24 bits
+	inline float Uniform(){
+		uint32_t result = s[0] + s[3];
+		uint32_t t = s[1] << 9;
+		s[2] ^= s[0];
+		s[3] ^= s[1];
+		s[1] ^= s[2];
+		s[0] ^= s[3];
+		s[2] ^= t;
+		s[3] = ( s[3] << 11 ) | ( s[3] >> 21 );
+		return ( result >> 8 ) / 16777216.0f;
+	};
+	
+private:
+	
+	uint32_t s[4];
+	
+};
+
+
 /// A class to read in the calibration file in ROOT's TConfig format.
 /// Each ASIC channel can have offset, gain and quadratic terms.
 /// Each channel also has a threshold (not implemented)
@@ -140,30 +299,46 @@ public:
 		return fInputFile;
 	}
 	float FebexEnergy( unsigned int sfp, unsigned int board, unsigned int ch, unsigned short raw );
+	float FebexEnergy( const FebexChannelCal &c, unsigned short raw );
+	static float Dither();
 	float FebexThreshold( unsigned int sfp, unsigned int board, unsigned int ch );
 	long FebexTime( unsigned int sfp, unsigned int board, unsigned int ch );
-	FebexMWD DoMWD( unsigned int sfp, unsigned int board, unsigned int ch, std::vector<unsigned short> trace, std::string trace_name );
-	FebexMWD DoMWD( unsigned int sfp, unsigned int board, unsigned int ch, std::vector<unsigned short> trace);
+	FebexMWD DoMWD( unsigned int sfp, unsigned int board, unsigned int ch, const std::vector<unsigned short> &trace, std::string trace_name );
+	FebexMWD DoMWD( unsigned int sfp, unsigned int board, unsigned int ch, const std::vector<unsigned short> &trace);
+	
+	// Same again, but reusing the memory of mwd from the last trace
+	void DoMWD( unsigned int sfp, unsigned int board, unsigned int ch, const std::vector<unsigned short> &trace, FebexMWD &mwd, std::string trace_name = "" );
+	
+	// All of the traces in a batch from the same channel
+	void DoMWD( unsigned int sfp, unsigned int board, unsigned int ch, FebexMWDBatch &batch );
+	
+	// Position of a channel in the table and all of its parameters.
+	// The channel must be valid, there's no check.
+	inline unsigned int GetFebexIndex( unsigned int sfp, unsigned int board, unsigned int ch ){
+		return ( sfp * set->GetNumberOfFebexBoards() + board ) * set->GetNumberOfFebexChannels() + ch;
+	};
+	inline const FebexChannelCal& GetFebexCal( unsigned int idx ){
+		return fFebexCal[idx];
+	};
+	inline bool IsFebexChannel( unsigned int sfp, unsigned int board, unsigned int ch ){
+		return sfp < set->GetNumberOfFebexSfps() &&
+			board < set->GetNumberOfFebexBoards() &&
+			ch < set->GetNumberOfFebexChannels();
+	};
 
 	
 private:
 
+	// Binary copy of the file, see ConfigCache
+	void CacheCalibration( ConfigCache &cache );
+
 	std::string fInputFile;
 	
 	std::shared_ptr<Settings> set;
 
-	std::vector< std::vector<std::vector<long>> > fFebexTime;
-	std::vector< std::vector<std::vector<float>> > fFebexOffset;
-	std::vector< std::vector<std::vector<float>> > fFebexGain;
-	std::vector< std::vector<std::vector<float>> > fFebexGainQuadr;
-	std::vector< std::vector<std::vector<float>> > fFebexThreshold;
-	std::vector< std::vector<std::vector<float>> > fFebexMWD_Decay;
-	std::vector< std::vector<std::vector<float>> > fFebexCFD_Fraction;
-	std::vector< std::vector<std::vector<unsigned int>> > fFebexMWD_Rise;
-	std::vector< std::vector<std::vector<unsigned int>> > fFebexMWD_Top;
-	std::vector< std::vector<std::vector<unsigned int>> > fFebexMWD_Window;
-	std::vector< std::vector<std::vector<unsigned int>> > fFebexCFD_Delay;
-	std::vector< std::vector<std::vector<int>> > fFebexCFD_Threshold; // polarity of CFD selected by a negative threshold
+	// Parameters of every channel, index from GetFebexIndex.
+	// It's all made from the file, so it's not written anywhere.
+	std::vector<FebexChannelCal> fFebexCal;	//!
 
 	float default_MWD_Decay;
 	float default_CFD_Fraction;
@@ -174,7 +349,7 @@ private:
 	int default_CFD_Threshold;
 
 	
-	ClassDef( Calibration, 10 )
+	ClassDef( Calibration, 12 )
    
 };
 
@@ -0,0 +1,76 @@
+#ifndef __COMPRESSEDFILE_HH
+#define __COMPRESSEDFILE_HH
+
+#include <condition_variable>
+#include <deque>
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <stdio.h>
+
+// Reads a compressed data file as a stream, so that it never has to be
+// uncompressed on disk. The format is found from the first bytes of the
+// file. The file is uncompressed in a background thread, a chunk at a
+// time, while the converter decodes what it has already.
+// gzip is always available from zlib, zstd and lz4 only if they were
+// found when compiling, see HAVE_ZSTD and HAVE_LZ4 in the Makefile.
+class CompressedFile {
+
+public:
+
+	CompressedFile();
+	~CompressedFile();
+
+	enum format_t {
+		FORMAT_NONE,	// not compressed, or not a format we know
+		FORMAT_GZIP,
+		FORMAT_ZSTD,
+		FORMAT_LZ4
+	};
+
+	static format_t GetFormat( std::string input_file_name );
+	static bool IsSupported( format_t fmt );
+	static std::string GetFormatName( format_t fmt );
+
+	bool Open( std::string input_file_name );
+	void Close();
+
+	// Same as reading a stream, they return the number of bytes we got
+	unsigned long long Read( char *data, unsigned long long length );
+	unsigned long long Ignore( unsigned long long length );
+
+
+private:
+
+	// Background thread, with one function for each format
+	void Decompress();
+	bool DecompressGzip();
+	bool DecompressZstd();
+	bool DecompressLz4();
+
+	// Hand a chunk to the reader, waiting if it's too far behind
+	bool PushChunk( std::vector<char> &chunk );
+
+	static const unsigned int chunk_size = 0x100000;	///< size of each uncompressed chunk
+	static const unsigned int max_chunks = 16;			///< chunks waiting to be read
+
+	// None of this is ever written to a file
+	FILE *input_file;						//!
+	format_t format;						//!
+	std::string file_name;					//!
+
+	std::thread worker;						//!
+	std::mutex chunk_lock;					//!
+	std::condition_variable chunk_ready;	//! a chunk was added, or we're done
+	std::condition_variable chunk_taken;	//! there's space for another chunk
+	std::deque<std::vector<char>> chunks;	//! uncompressed data waiting to be read
+	unsigned long long chunk_pos;			//! bytes already read from the front chunk
+	bool flag_done;							//! no more chunks are coming
+	bool flag_stop;							//! reader is closing, so stop early
+
+};
+
+#endif
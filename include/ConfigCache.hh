@@ -0,0 +1,92 @@
+#ifndef __CONFIGCACHE_HH
+#define __CONFIGCACHE_HH
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <cstring>
+#include <type_traits>
+
+// A binary copy of what was read from a settings or calibration file,
+// kept in a sidecar file next to it, i.e. settings.dat.cache for
+// settings.dat. It is found again from a hash of the text file, so it
+// is made again as soon as the file changes. The whole cache is read
+// in one go and then unpacked with Data(), in the same order that it
+// was packed with Data() when it was made.
+class ConfigCache {
+
+public:
+
+	// The key is anything else the contents depend on,
+	// e.g. the class version or the number of channels
+	ConfigCache( std::string input_file_name, unsigned long long key );
+	~ConfigCache() {};
+
+	static inline std::string GetCacheFileName( std::string input_file_name ){
+		return input_file_name + ".cache";
+	};
+
+	// Is there a cache that matches the input file? If so, the
+	// Data() calls unpack it, otherwise they pack a new one to Save()
+	bool Load();
+	bool Save();
+
+	// True if there was nothing wrong with the unpacking
+	inline bool IsGood(){ return flag_good && ( !flag_read || pos == buffer.size() ); };
+	inline bool IsReading(){ return flag_read; };
+
+	// Pack or unpack anything that can be copied as bytes,
+	// and vectors and strings of them
+	template<typename T>
+	inline void Data( T &x ){
+		static_assert( std::is_trivially_copyable<T>::value, "ConfigCache::Data needs plain data" );
+		if( flag_read ) {
+			if( pos + sizeof(T) > buffer.size() ) { flag_good = false; return; }
+			std::memcpy( &x, buffer.data() + pos, sizeof(T) );
+			pos += sizeof(T);
+		}
+		else buffer.insert( buffer.end(), (const char*)&x, (const char*)&x + sizeof(T) );
+	};
+
+	template<typename T>
+	inline void Data( std::vector<T> &v ){
+		unsigned long long n = v.size();
+		Data( n );
+		if( flag_read ) {
+			if( !flag_good || n > buffer.size() - pos ) { flag_good = false; return; }
+			v.resize( n );
+		}
+		for( unsigned long long i = 0; i < n && flag_good; ++i )
+			Data( v[i] );
+	};
+
+	inline void Data( std::string &s ){
+		unsigned long long n = s.size();
+		Data( n );
+		if( flag_read ) {
+			if( !flag_good || n > buffer.size() - pos ) { flag_good = false; return; }
+			s.assign( buffer.data() + pos, n );
+			pos += n;
+		}
+		else buffer.insert( buffer.end(), s.begin(), s.end() );
+	};
+
+
+private:
+
+	bool HashFile();
+
+	std::string input_file;		///< text file that was read
+	std::string cache_file;		///< where the cache goes
+	unsigned long long key;		///< anything else the cache depends on
+	unsigned long long hash;	///< hash of the text file
+	bool flag_hash;				///< could we read the text file?
+
+	std::vector<char> buffer;	///< packed contents
+	unsigned long long pos;		///< where we are unpacking
+	bool flag_read;				///< unpacking rather than packing
+	bool flag_good;				///< nothing went wrong unpacking
+
+};
+
+#endif
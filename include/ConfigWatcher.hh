@@ -0,0 +1,59 @@
+#ifndef __CONFIGWATCHER_HH
+#define __CONFIGWATCHER_HH
+
+#include <atomic>
+#include <functional>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Watches the calibration and reaction files while the monitor is
+// running. When one of them has been written, its callback is called
+// on the watcher's own thread, so reading the file again is done there
+// and not in the monitor loop. On Linux we wait on inotify, watching the
+// directory rather than the file, because most editors save by writing a
+// new file and renaming it. Anywhere else, we just look every second.
+class ConfigWatcher {
+
+public:
+
+	ConfigWatcher();
+	~ConfigWatcher();
+
+	// Call back when the file changes, but only once it has stopped changing
+	bool Watch( std::string file_name, std::function<void()> callback );
+
+	bool Start();
+	void Stop();
+
+
+private:
+
+	// Background thread that waits for the files to change
+	void WatchFiles();
+
+	// Anything that changes when a file is written again
+	struct FileState {
+		long long mtime;	///< modification time in ns
+		long long size;		///< size in bytes
+		long long inode;	///< changes when the file is replaced
+		bool operator!=( const FileState &other ) const {
+			return mtime != other.mtime || size != other.size || inode != other.inode;
+		};
+	};
+	static bool GetFileState( std::string file_name, FileState &state );
+
+	int fd;											//! inotify, or -1
+	std::vector<std::string> files;					//!
+	std::vector<std::function<void()>> callbacks;	//!
+	std::vector<FileState> last_state;				//! state when last called back
+	std::vector<FileState> new_state;				//! state seen, but not settled
+	std::vector<bool> flag_changed;					//! waiting to settle
+
+	std::thread worker;								//!
+	std::atomic<bool> flag_stop;					//! monitor is closing
+
+};
+
+#endif
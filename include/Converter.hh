@@ -1,23 +1,39 @@
 #ifndef __CONVERTER_HH
 #define __CONVERTER_HH
 
+#include <algorithm>
+#include <atomic>
 #include <bitset>
+#include <cerrno>
+#include <condition_variable>
+#include <cstdlib>
+#include <functional>
 #include <memory>
+#include <mutex>
 #include <fstream>
 #include <iostream>
 #include <iomanip>
+#include <queue>
 #include <stdio.h>
 #include <sstream>
 #include <string>
+#include <thread>
+#include <vector>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 #include <TFile.h>
+#include <TEnv.h>
 #include <TTree.h>
-#include <TTreeIndex.h>
 #include <TH1.h>
 #include <TH2.h>
 #include <TProfile.h>
 #include <TGProgressBar.h>
 #include <TSystem.h>
+#include <TROOT.h>
 
 // Settings header
 #ifndef __SETTINGS_HH
@@ -34,55 +50,262 @@
 # include "DataPackets.hh"
 #endif
 
+// Block index header
+#ifndef __BLOCKINDEX_HH
+# include "BlockIndex.hh"
+#endif
+
+#ifndef __COMPRESSEDFILE_HH
+# include "CompressedFile.hh"
+#endif
+
+#ifndef __BLOCKREADER_HH
+# include "BlockReader.hh"
+#endif
+
+// Values for one FEBEX data word or trace header that only need the
+// calibration. They are worked out when the block is decoded, so the
+// pass over the blocks in order just puts the hits together.
+struct DecodedFebex {
+	
+	float energy;				///< calibrated energy, for 16-bit integer data
+	unsigned short cal_bin;		///< bin of the energy in the calibrated spectrum
+	bool threshold;				///< is the charge over threshold?
+	long time;					///< time offset of the channel
+	
+};
+
+// Everything decoded from a single block that does not depend on the
+// blocks before it. Blocks can be decoded in any order, or in parallel,
+// and are then processed in order to extend the timestamps and fill.
+struct DecodedBlock {
+	
+	unsigned long nblock;							///< block number in the file
+	UInt_t header_sequence;							///< sequence number from the block header
+	UShort_t header_DataEndian;						///< 256 if the data has the right endianness
+	UInt_t header_DataLen;							///< length of the data in bytes
+	bool flag_header;								///< was the header good?
+	bool flag_terminator;							///< did we find the end of the data?
+	std::vector<ULong64_t> words;					///< data words in native order, without trace samples
+	std::vector<ULong64_t> native;					///< block data after swapping, if it needed it
+	unsigned int ntraces;							///< number of trace headers in words
+	std::vector<std::vector<unsigned short>> traces;	///< samples for each trace header, reused between blocks
+	std::vector<std::vector<float>> mwd_energies;	///< MWD energies for each trace header in words
+	std::vector<DecodedFebex> febex;				///< for each FEBEX data word and trace header in words
+	FebexMWD mwd;									///< MWD of the last trace, reused for the next one
+	
+};
+
+// Counts for a spectrum with one bin for each integer from 0 to 65535,
+// like the raw and MWD spectra. Filling this is much quicker than a TH1F
+// and nothing is allocated until the first count. Other spectra can be
+// counted too, with FillBin, if the bin is found some other way.
+class CountSpectrum {
+	
+public:
+	
+	CountSpectrum( unsigned int n = 65536 ) : nbins(n), entries(0) {};
+	
+	inline void Fill( double x ){
+		if( x < -0.5 ) FillBin( 0 );
+		else if( x < nbins - 0.5 ) FillBin( (unsigned int)( x + 0.5 ) + 1 );
+		else FillBin( nbins + 1 );
+	};
+	inline void FillBin( unsigned int bin ){
+		if( counts.empty() ) counts.resize( nbins + 2, 0 );
+		counts[bin]++;
+		entries++;
+	};
+	inline ULong64_t GetEntries(){ return entries; };
+	inline void Clear(){
+		std::fill( counts.begin(), counts.end(), 0 );
+		entries = 0;
+	};
+	
+	// Add the counts to a histogram with the same binning and start again
+	inline void AddTo( TH1F *h ){
+		for( unsigned int i = 0; i < counts.size(); ++i )
+			if( counts[i] ) h->AddBinContent( i, counts[i] );
+		double nentries = h->GetEntries() + entries;
+		h->ResetStats();
+		h->SetEntries( nentries );
+		std::fill( counts.begin(), counts.end(), 0 );
+		entries = 0;
+	};
+	
+private:
+	
+	unsigned int nbins;				///< number of bins, not counting under and overflow
+	std::vector<UInt_t> counts;		///< underflow, each bin, then overflow
+	ULong64_t entries;				///< number of counts since the last AddTo
+	
+};
+
+// A hit waiting in the reorder buffer of the streaming sort
+struct ReorderHit {
+	
+	SortHit hit;
+	ULong64_t seq;							///< order that the hits arrived
+	std::vector<unsigned short> samples;	///< trace samples of the hit
+	
+	// Heap ordering, so the earliest hit is at the front
+	inline bool operator>( const ReorderHit &rhs ) const {
+		if( hit.time != rhs.hit.time ) return hit.time > rhs.hit.time;
+		return seq > rhs.seq;
+	};
+	
+};
+
+// A sorted chunk of hits that was written to disk, read back in order
+struct SortChunk {
+	
+	std::string name;						///< file name of the chunk
+	std::ifstream file;
+	std::vector<char> buffer;				///< read buffer for the file
+	SortHit hit;							///< the current hit
+	std::vector<unsigned short> samples;	///< trace samples of the current hit
+	bool failed;							///< the file couldn't be opened or read
+	
+	inline bool Open( std::string myname ){
+		name = myname;
+		buffer.resize( 1 << 20 );
+		file.rdbuf()->pubsetbuf( buffer.data(), buffer.size() );
+		file.open( name, std::ios::in|std::ios::binary );
+		failed = !file.is_open();
+		return !failed;
+	};
+	
+	// False at the end of the chunk, or if it can't be read
+	inline bool Next(){
+		file.read( (char*)&hit, sizeof(SortHit) );
+		if( file.gcount() == 0 && file.eof() ) return false;
+		if( file.good() ) {
+			samples.resize( hit.trace_length );
+			file.read( (char*)samples.data(), hit.trace_length * sizeof(unsigned short) );
+		}
+		failed = !file.good();
+		return !failed;
+	};
+	
+};
+
 class Converter {
 
 public:
 	
 	Converter( std::shared_ptr<Settings> myset );
-	~Converter() {};
+	~Converter();
 	
 
 	int ConvertFile( std::string input_file_name,
 					unsigned long start_block = 0,
 					long end_block = -1);
-	int ConvertBlock( char *input_block, int nblock );
+	int ConvertBlock( const char *input_block, unsigned int length, int nblock );
+	int ConvertTimeWindow( std::string input_file_name,
+						  ULong64_t tmin, ULong64_t tmax );
 	void MakeHists();
+	void UpdateHists();
+	void ResetCalHists();
 	void MakeTree();
 	unsigned long long SortTree();
 
 	bool ProcessCurrentBlock( int nblock );
 
 	void SetBlockHeader( char *input_header );
-	void ProcessBlockHeader( unsigned long nblock );
+	void ProcessBlockHeader( const char *header, DecodedBlock &blk );
 
 	void SetBlockData( char *input_data );
-	void ProcessBlockData( unsigned long nblock );
+	void ProcessBlockData( const ULong64_t *data, DecodedBlock &blk );
+	unsigned int DecodeTraceData( const ULong64_t *data,
+								 unsigned int pos, DecodedBlock &blk );
+
+	void DecodeBlock( const char *header, const char *data,
+					 unsigned long nblock, DecodedBlock &blk );
+	void DecodeBatch( unsigned int nbatch );
+	bool ProcessDecodedBlock( DecodedBlock &blk );
+
+	bool MapInputFile( int fd, unsigned long long offset, unsigned long long size );
+	void UnmapInputFile();
+
+	bool LoadBlockIndex( std::string input_file_name );
+	bool BuildBlockIndex( std::string input_file_name );
+	void IndexDecodedBlock( DecodedBlock &blk );
+	bool IsBlockSelected( unsigned long nblock );
+	void JumpToBlock( unsigned long nblock );
 
 	bool GetFebexChanID();
-	int  ProcessTraceData( int pos );
-	void ProcessFebexData();
+	void DecodeFebexData( ULong64_t word, DecodedBlock &blk );
+	void ProcessTraceData( DecodedBlock &blk, unsigned int idx, const DecodedFebex &fc );
+	void ProcessFebexData( const DecodedFebex &fc );
 	void FinishFebexData();
 	void ProcessInfoData();
 
-	void SetOutput( std::string output_file_name );
+	// With checkpoints, the state of a long conversion is saved every
+	// CheckpointBlocks blocks. After an interruption, ResumeOutput opens
+	// the output again and the conversion carries on from the checkpoint.
+	void SetOutput( std::string output_file_name, bool flag_checkpoint = false );
+	bool ResumeOutput( std::string output_file_name );
 	
 	inline void CloseOutput(){
 		std::cout << "\n Writing data and closing the file" << std::endl;
+		UpdateHists();
 		output_file->Write( 0, TObject::kWriteDelete );
 		output_file->Close();
+		RemoveCheckpoint();
 	};
 	inline TFile* GetFile(){ return output_file; };
-	inline TTree* GetTree(){ return output_tree; };
 	inline TTree* GetSortedTree(){ return sorted_tree; };
+	inline TTree* GetSampleTree(){ return sample_tree; };
+	
+	// Hits are queued for each SFP and board until they are sorted
+	void QueueData( std::shared_ptr<FebexData> data );
+	void QueueData( std::shared_ptr<InfoData> data );
+	void FillSortedData( const SortHit &hit, const unsigned short *samples );
+	void SortQueues();
+	void SpillQueues();
+	unsigned long long MergeSorted( std::ofstream *spill = nullptr );
+	void MergeChunks();
+	std::string MergeChunkGroup( unsigned int first, unsigned int last );
+	std::string SortChunkName();
+	bool ReadChunk( SortChunk &chunk );
+	void ResetSortedTree();
+	void FlushSamples();
+	void ReorderData( ReorderHit &rhit );
+	void EmitReorderHit();
+	inline unsigned int GetBlockSize(){ return DATA_BLOCK_SIZE; };
+	inline unsigned int GetQueueIndex( unsigned char sfp, unsigned char board ){
+		if( sfp >= set->GetNumberOfFebexSfps() || board >= set->GetNumberOfFebexBoards() )
+			return set->GetNumberOfFebexSfps() * set->GetNumberOfFebexBoards();
+		return sfp * set->GetNumberOfFebexBoards() + board;
+	};
 
 	inline void AddCalibration( std::shared_ptr<Calibration> mycal ){ cal = mycal; };
 	inline void SourceOnly(){ flag_source = true; };
+	
+	// Number of threads used to decode blocks, at least one
+	// and no more than the number of cores that we have
+	void SetNumberOfThreads( int n );
+
+	// Write the block index next to the input file, when the whole file is
+	// converted, so that a time window or some boards can be found quickly
+	inline void SetWriteIndex( bool flag ){ flag_write_index = flag; };
+
+	// Only convert blocks with hits from these boards, using the block index
+	inline void SelectBoard( unsigned char sfp, unsigned char board ){
+		board_select.push_back( std::make_pair( sfp, board ) );
+	};
+	inline void ClearBoardSelection(){ board_select.clear(); };
+	inline std::shared_ptr<BlockIndex> GetBlockIndex(){ return block_index; };
 
 	inline void AddProgressBar( std::shared_ptr<TGProgressBar> myprog ){
 		prog = myprog;
 		_prog_ = true;
 	};
 
+	// When converting many files at once, the terminal progress has the
+	// file name on each line instead of writing over the same line
+	inline void SetJobName( std::string name ){ job_name = name; };
+
 
 
 private:
@@ -93,10 +316,9 @@ private:
 		SWAP_WORDS  = 2,  // We need to swap pairs of 32-bit words
 		SWAP_ENDIAN = 4   // We need to swap endianness
 	};
-	Int_t swap;
 
 	// Swap endianness of a 32-bit integer 0x01234567 -> 0x67452301
-	inline UInt_t Swap32(UInt_t datum) {
+	static inline UInt_t Swap32(UInt_t datum) {
 		return(((datum & 0xFF000000) >> 24) |
 			   ((datum & 0x00FF0000) >>  8) |
 			   ((datum & 0x0000FF00) <<  8) |
@@ -105,14 +327,14 @@ private:
 	
 	// Swap the two halves of a 64-bit integer 0x0123456789ABCDEF ->
 	// 0x89ABCDEF01234567
-	inline ULong64_t SwapWords(ULong64_t datum) {
+	static inline ULong64_t SwapWords(ULong64_t datum) {
 		return(((datum & 0xFFFFFFFF00000000LL) >> 32) |
 			   ((datum & 0x00000000FFFFFFFFLL) << 32));
 	};
 	
 	// Swap endianness of a 64-bit integer 0x0123456789ABCDEF ->
 	// 0xEFCDAB8967452301
-	inline ULong64_t Swap64(ULong64_t datum) {
+	static inline ULong64_t Swap64(ULong64_t datum) {
 		return(((datum & 0xFF00000000000000LL) >> 56) |
 			   ((datum & 0x00FF000000000000LL) >> 40) |
 			   ((datum & 0x0000FF0000000000LL) >> 24) |
@@ -123,17 +345,34 @@ private:
 			   ((datum & 0x00000000000000FFLL) << 56));
 	};
 	
-	// Get nth word
-	inline ULong64_t GetWord( UInt_t n = 0 ){
+	// Swap a whole block of words, using the kernel for that swap mode.
+	// The kernels are picked once, in SelectKernels, for this CPU.
+	typedef void (*swap_block_t)( const ULong64_t *in, ULong64_t *out, unsigned int n );
+	swap_block_t swap_block[4];
+	void SelectKernels();
+	template<int swap> static void SwapBlockScalar( const ULong64_t *in, ULong64_t *out, unsigned int n );
+	template<int swap> static void SwapBlockSSSE3( const ULong64_t *in, ULong64_t *out, unsigned int n );
+	template<int swap> static void SwapBlockAVX2( const ULong64_t *in, ULong64_t *out, unsigned int n );
+	
+	// Unpack trace sample words, with a kernel picked in SelectKernels too
+	typedef unsigned int (*unpack_trace_t)( const ULong64_t *in, unsigned short *out, unsigned int n );
+	unpack_trace_t unpack_trace;
+	static unsigned int UnpackTraceScalar( const ULong64_t *in, unsigned short *out, unsigned int n );
+	static unsigned int UnpackTraceSSSE3( const ULong64_t *in, unsigned short *out, unsigned int n );
+	static unsigned int UnpackTraceAVX2( const ULong64_t *in, unsigned short *out, unsigned int n );
+	
+	// Block size, either from the settings or found from the data
+	void SetBlockSize( unsigned int block_size );
+	unsigned int DetectBlockSize( const char *data, unsigned long long length );
+	void FindBlockSize( std::string input_file_name );
+	
+	// Get nth word, the block is already in native order
+	inline ULong64_t GetWord( const ULong64_t *data, UInt_t n = 0 ){
 
 		// If word number is out of range, return zero
 		if( n >= WORD_SIZE ) return(0);
 
-		// Perform byte swapping according to swap mode
-		ULong64_t result = data[n];
-		if (swap & SWAP_ENDIAN) result = Swap64(result);
-		if (swap & SWAP_WORDS)  result = SwapWords(result);
-		return(result);
+		return( data[n] );
 		
 	};
 
@@ -144,30 +383,63 @@ private:
 	// Logs
 	std::stringstream sslogs;
 	
-	// Set the size of the block and its components.
+	// Size of the block and its components. The block size comes from the
+	// settings, or from the first block in the file if it is set to 0.
 	static const int HEADER_SIZE = 24; // Size of header in bytes
-	static const int DATA_BLOCK_SIZE = 0x10000; // Block size for FEBEX data = 64 kB?
-	static const int MAIN_SIZE = DATA_BLOCK_SIZE - HEADER_SIZE;
-	static const int WORD_SIZE = MAIN_SIZE / sizeof(ULong64_t);
-
-	// Set the arrays for the block components.
-	char block_header[HEADER_SIZE];
-	char block_data[MAIN_SIZE];
+	static const unsigned int MIN_BLOCK_SIZE = 0x1000;		// smallest block we look for
+	static const unsigned int MAX_BLOCK_SIZE = 0x100000;	// largest block we look for
+	unsigned int DATA_BLOCK_SIZE;		///< block size for FEBEX data, usually 64 kB
+	unsigned int MAIN_SIZE;				///< data in each block, after the header
+	unsigned int WORD_SIZE;				///< number of 64-bit words in MAIN_SIZE
+	bool flag_auto_block_size;			///< work out the block size from the data
+	std::string block_size_file;		///< file that the block size was found from
+
+	// Set the arrays for the block components when they are copied in.
+	char block_header_buf[HEADER_SIZE];
+	std::vector<char> block_data_buf;
+
+	// Pointers to the header and data of the current block.
+	// These point either to the arrays above or into the mapped file.
+	const char *block_header;
+	const char *block_data;
+
+	// Memory mapped input file, if we could map it
+	char *map_data;
+	unsigned long long map_size;
+	
+	// Blocks are decoded in batches, with each thread taking the next
+	// block until they're all done. The threads are started for the first
+	// batch and then wait for the next one, until the Converter goes.
+	static const int BLOCKS_PER_THREAD = 16;
+	unsigned int nthreads;
+	void StartDecodeThreads();
+	void StopDecodeThreads();
+	void DecodeThread();
+	std::vector<std::thread> decode_threads;	//!
+	std::mutex decode_lock;					//!
+	std::condition_variable decode_start;	//! a new batch, or time to stop
+	std::condition_variable decode_finish;	//! all threads are done with the batch
+	unsigned long decode_generation;		//! number of batches handed out
+	unsigned int decode_nbatch;				//! blocks in this batch
+	std::atomic<unsigned int> decode_next;	//! next block for a thread to take
+	unsigned int decode_nbusy;				//! threads still on this batch
+	bool decode_stop;						//! the threads should finish
+	std::vector<const char*> batch_blocks;
+	std::vector<char> batch_buffer;
+	std::vector<DecodedBlock> decoded;
 	
-	// Data words - 1 word of 64 bits (8 bytes)
-	ULong64_t word;
+	// Index of the blocks in the input file
+	std::shared_ptr<BlockIndex> block_index;
+	std::string block_index_file;	///< input file that the index belongs to
+	bool flag_index_only;			///< only build the index, don't convert
+	bool flag_write_index;			///< write the index next to the input file
+	unsigned long idx_tm_stp_msb;	///< timestamp MSB while indexing
+	unsigned long idx_tm_stp_hsb;	///< timestamp HSB while indexing
+	std::vector<std::pair<unsigned char,unsigned char>> board_select;
 	
 	// Data words - 2 words of 32 bits (4 byte).
 	UInt_t word_0;
 	UInt_t word_1;
-	
-	// Pointer to the data words
-	ULong64_t *data;
-	
-	// End of data in  a block looks like:
-	// word_0 = 0xFFFFFFFF, word_1 = 0xFFFFFFFF.
-	// This flag is set true when we hit that point
-	bool flag_terminator;
 
 	// Flag to identify Febex data words
 	bool flag_febex_data0;
@@ -178,15 +450,6 @@ private:
 	bool flag_febex_info;
 
 
-	// Raw data variables
-	Char_t header_id[8]; // 8 byte. Must be this string 'EBYEDATA'.
-	UInt_t header_sequence; // 4 byte.
-	UShort_t header_stream; // 2 byte.
-	UShort_t header_tape; // 2 byte.
-	UShort_t header_MyEndian; // 2 byte. If 1 then correct endianess.
-	UShort_t header_DataEndian; // 2 byte.
-	UInt_t header_DataLen; // 4 byte.
-	
 	// Interpretated variables
 	unsigned long long my_tm_stp;
 	unsigned long my_tm_stp_lsb;
@@ -205,12 +468,7 @@ private:
 	unsigned char my_data_id;
 	bool my_fail, my_veto;
 	float my_energy;
-
-	// For traces
-	unsigned int nsamples;
-	ULong64_t sample_packet;
-	unsigned char trace_test;
-	UInt_t block_test;
+	long my_time_offset;	///< time offset of the channel of the current hit
 
 	// Data types
 	std::shared_ptr<DataPackets> data_packet = 0;
@@ -219,8 +477,56 @@ private:
 	
 	// Output stuff
 	TFile *output_file;
-	TTree *output_tree;
 	TTree *sorted_tree;
+	
+	// Flat output, when FlatHitOutput is set in the settings. The trace
+	// samples of all hits are in one array, filled in to sample_tree in
+	// entries of SortHit::samples_per_entry.
+	TTree *sample_tree;
+	SortHit flat_hit;						///< branch addresses of the flat hit tree
+	std::vector<unsigned short> flat_samples;	///< samples waiting to go in the sample tree
+	unsigned int flat_nsamples;				///< number of samples in flat_samples
+	ULong64_t flat_sample_pos;				///< position of the next sample in the array
+	
+	// Hits waiting to be sorted, one queue for each SFP and board and
+	// one extra for anything else. The trace samples are kept separately.
+	std::vector<std::vector<SortHit>> sort_queue;
+	std::vector<std::vector<unsigned short>> sort_samples;
+	std::shared_ptr<FebexData> sort_febex;
+	std::shared_ptr<InfoData> sort_info;
+	
+	// When the queues get too big, they are written to disk as sorted
+	// chunks and merged with the rest at the end
+	unsigned long long sort_bytes;			///< memory used by the queues
+	std::string sort_dir;					///< where to write the chunks
+	std::vector<std::string> sort_chunks;	///< chunks written so far
+	unsigned long long sort_chunk_hits;		///< number of hits in the chunks
+	unsigned int sort_chunk_count;			///< chunk files named so far
+	
+	// Each open chunk has a file and a 1 MB read buffer, so the chunks
+	// are merged in groups of this many until they can all be opened
+	static const unsigned int MAX_MERGE_CHUNKS = 64;
+	
+	// Streaming sort, when there is a SortWindow in the settings. Hits are
+	// held in a heap and go to the tree once they are older than the window.
+	std::vector<ReorderHit> reorder_buffer;
+	ULong64_t reorder_seq;					///< number of hits so far
+	ULong64_t reorder_newest;				///< latest time of any hit
+	ULong64_t reorder_last;					///< time of the last hit in the tree
+	unsigned long long ctr_reorder_fill;	///< hits in the tree since the last SortTree
+	unsigned long long ctr_reorder_late;	///< hits that came later than the window
+	bool flag_reset_sorted;					///< empty the tree before the next hit
+	
+	// Checkpoints of the conversion. Everything up to the checkpoint is
+	// in the output file, or in the sorted chunks, before it is written.
+	void SetSortDir( std::string output_file_name );
+	void WriteCheckpoint( std::string input_file_name, unsigned long nblock );
+	void RemoveCheckpoint();
+	bool ResumeTrees();
+	std::string checkpoint_file;			///< next to the output file, empty for no checkpoints
+	std::string resume_input_file;			///< input file of the checkpoint
+	unsigned long resume_block;				///< first block after the checkpoint
+	bool flag_resume;						///< carry on from the checkpoint
 
 	// Counters
 	std::vector<std::vector<unsigned long>> ctr_febex_hit;		// hits on each Febex module
@@ -234,9 +540,25 @@ private:
 	std::vector<std::vector<TProfile*>> hfebex_resume;
 	TProfile *hfebex_ext;
 
+	// Spectra for each channel, made on the first hit in that channel.
+	// The spectra are counted in cnt_febex, cnt_febex_cal and cnt_febex_mwd
+	// and only added to the histograms by UpdateHists. The bin of each
+	// calibrated energy is found when the block is decoded.
+	static const unsigned int CAL_NBINS = 8000;
+	static constexpr double CAL_MIN = -0.25;
+	static constexpr double CAL_MAX = 3999.75;
+	enum spec_t {
+		SPEC_RAW,	// raw charge
+		SPEC_CAL,	// calibrated energy
+		SPEC_MWD	// MWD energy
+	};
 	std::vector<std::vector<std::vector<TH1F*>>> hfebex;
 	std::vector<std::vector<std::vector<TH1F*>>> hfebex_cal;
 	std::vector<std::vector<std::vector<TH1F*>>> hfebex_mwd;
+	std::vector<std::vector<std::vector<CountSpectrum>>> cnt_febex;
+	std::vector<std::vector<std::vector<CountSpectrum>>> cnt_febex_cal;
+	std::vector<std::vector<std::vector<CountSpectrum>>> cnt_febex_mwd;
+	TH1F* MakeFebexHist( unsigned char sfp, unsigned char board, unsigned char ch, spec_t type );
 
 	// 	Settings file
 	std::shared_ptr<Settings> set;
@@ -247,6 +569,12 @@ private:
 	// Progress bar
 	bool _prog_;
 	std::shared_ptr<TGProgressBar> prog;
+	
+	// Progress of one file in a parallel conversion
+	void PrintJobProgress( std::string stage, float percent );
+	std::string job_name;		///< name of the file in the terminal progress, empty if there's only one
+	std::string job_stage;		///< what we are doing now
+	int job_percent;			///< last percentage printed
 
 };
 
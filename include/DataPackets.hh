@@ -1,17 +1,26 @@
 #ifndef __DATAPACKETS_HH
 #define __DATAPACKETS_HH
 
+#include <algorithm>
+#include <iostream>
 #include <memory>
 
 #include "TObject.h"
 #include "TVector.h"
 #include "TGraph.h"
 
+// Trace compression
+#ifndef __TRACECODEC_HH
+# include "TraceCodec.hh"
+#endif
+
+class TTree;
+
 class FebexData : public TObject {
 	
 public:
 
-	FebexData() {};
+	FebexData() : trace_length(0) {};
 	FebexData( unsigned long long t,
 			  float qf, Float16_t qh, unsigned short qi,
 			  std::vector<unsigned short> tr,
@@ -20,7 +29,7 @@ public:
 	~FebexData() {};
 
 	inline unsigned long long	GetTime() { return time; };
-	inline unsigned short		GetTraceLength() { return trace.size(); };
+	inline unsigned short		GetTraceLength() { return trace_length; };
 	inline unsigned short		GetQint() { return Qint; };
 	inline Float16_t			GetQhalf() { return Qhalf; };
 	inline float				GetQfloat() { return Qfloat; };
@@ -31,7 +40,10 @@ public:
 	inline bool					IsOverThreshold() { return thres; };
 	inline bool					IsVeto() { return veto; };
 	inline bool					IsFail() { return fail; };
-	inline std::vector<unsigned short> GetTrace() { return trace; };
+	inline const std::vector<unsigned short>& GetTrace() {
+		if( trace.size() != trace_length ) UnpackTrace();
+		return trace;
+	};
 	inline TGraph* GetTraceGraph() {
 		std::vector<int> x, y;
 		std::string title = "Trace for SFP " + std::to_string( GetSfp() );
@@ -47,13 +59,24 @@ public:
 		return (TGraph*)g.get()->Clone();
 	};
 	inline unsigned short		GetSample( unsigned int i = 0 ) {
-		if( i >= trace.size() ) return 0;
-		return trace.at(i);
+		if( i >= trace_length ) return 0;
+		return GetTrace().at(i);
 	};
 	
 	inline void	SetTime( unsigned long long t ) { time = t; };
-	inline void	SetTrace( std::vector<unsigned short> t ) { trace = t; };
-	inline void AddSample( unsigned short s ) { trace.push_back(s); };
+	inline void	SetTrace( const std::vector<unsigned short> &t ) {
+		trace = t;
+		trace_length = t.size();
+		packed_trace.clear();
+	};
+	inline void AddSample( unsigned short s ) {
+		GetTrace();
+		trace.push_back(s);
+		trace_length++;
+		packed_trace.clear();
+	};
+	void SetPackedTrace( const unsigned short *samples, unsigned short nsamples );
+	void UnpackTrace();
 	inline void	SetQint( unsigned short q ) { Qint = q; };
 	inline void	SetQhalf( Float16_t q ) { Qhalf = q; };
 	inline void	SetQfloat( float q ) { Qfloat = q; };
@@ -65,7 +88,11 @@ public:
 	inline void SetVeto( bool v ){ veto = v; };
 	inline void SetFail( bool f ){ fail = f; };
 
-	inline void ClearTrace() { trace.clear(); };
+	inline void ClearTrace() {
+		trace.clear();
+		packed_trace.clear();
+		trace_length = 0;
+	};
 	void ClearData();
 
 protected:
@@ -75,7 +102,9 @@ protected:
 	float						Qfloat;		///< Charge from firmware as 32-bit float
 	Float16_t					Qhalf;		///< Charge from firmware as 16-bit float
 	unsigned short				Qint;		///< Charge from firmware as 16-bit integer
-	std::vector<unsigned short>	trace;
+	unsigned short				trace_length;	///< number of samples in the trace
+	std::vector<unsigned char>	packed_trace;	///< trace samples compressed by TraceCodec
+	std::vector<unsigned short>	trace;		//! trace samples, unpacked when they're needed
 	unsigned char				sfp;		///< SFP ID of the event
 	unsigned char				board;		///< board ID of the event
 	unsigned char				ch;			///< channel ID of the event
@@ -84,7 +113,7 @@ protected:
 	bool						fail;		///< fail bit from data stream
 
 	
-	ClassDef( FebexData, 1 )
+	ClassDef( FebexData, 2 )
 	
 };
 
@@ -156,5 +185,41 @@ protected:
 
 };
 
+// A single hit as a flat record. It is used for the hits waiting to be
+// time sorted and for the flat output tree (FlatHitOutput in the settings),
+// where every member is its own branch and the trace samples are stored
+// in one shared array, in a separate tree, starting from trace_start.
+struct SortHit {
+	
+	ULong64_t time;				///< timestamp, including the time offset
+	ULong64_t trace_start;		///< position of the first sample in the store
+	float energy;				///< calibrated energy
+	float Qfloat;				///< charge from firmware as 32-bit float
+	float Qhalf;				///< charge from firmware as 16-bit float
+	UShort_t Qint;				///< charge from firmware as 16-bit integer
+	UShort_t trace_length;		///< number of samples in the trace
+	UChar_t sfp;				///< SFP ID of the hit
+	UChar_t board;				///< board ID of the hit
+	UChar_t ch;					///< channel ID of the hit
+	UChar_t code;				///< info code, for info data only
+	UChar_t flags;				///< see SortHit::flag_t
+	
+	// Flags for each hit
+	enum flag_t {
+		HIT_INFO  = 1,	// info data rather than FEBEX data
+		HIT_THRES = 2,	// energy over threshold
+		HIT_VETO  = 4,	// veto bit
+		HIT_FAIL  = 8	// fail bit
+	};
+	
+	// Samples in each entry of the sample tree
+	static const unsigned int samples_per_entry = 4096;
+	
+	// Flat branches, to write a tree or read one back
+	void MakeBranches( TTree *tree );
+	void SetBranchAddresses( TTree *tree, bool read_trace = true );
+	
+};
+
 
 #endif
@@ -66,6 +66,19 @@ public:
 	};
 	
 	unsigned long	BuildEvents();
+	
+	// Hits come from DataPackets or from the flat hit tree
+	inline unsigned long long GetHitTime(){
+		return flag_flat_input ? flat_hit.time : in_data->GetTime();
+	};
+	inline bool IsFebexHit(){
+		return flag_flat_input ? !( flat_hit.flags & SortHit::HIT_INFO ) : in_data->IsFebex();
+	};
+	inline bool IsInfoHit(){
+		return flag_flat_input ? flat_hit.flags & SortHit::HIT_INFO : in_data->IsInfo();
+	};
+	void GetFebexHit();
+	void GetInfoHit();
 
 	// Resolve multiplicities and coincidences etc
 	void GammaRayFinder();
@@ -90,6 +103,8 @@ private:
 	TFile *input_file;
 	TTree *input_tree;
 	DataPackets *in_data;
+	SortHit flat_hit;			///< branch addresses for the flat hit tree
+	bool flag_flat_input;		///< input is the flat hit tree, not DataPackets
 	std::shared_ptr<FebexData> febex_data;
 	std::shared_ptr<InfoData> info_data;
 
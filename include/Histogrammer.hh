@@ -42,6 +42,7 @@ public:
 	~Histogrammer() {};
 	
 	void MakeHists();
+	void ResetHists( TDirectory *dir = nullptr );
 	unsigned long FillHists();
 	void FillParticleGammaHists( std::shared_ptr<GammaRayEvt> g );
 	void FillParticleGammaHists( std::shared_ptr<GammaRayAddbackEvt> g );
@@ -61,6 +62,8 @@ public:
 	};
 
 	inline TFile* GetFile(){ return output_file; };
+	
+	inline void AddReaction( std::shared_ptr<Reaction> myreact ){ react = myreact; };
 
 	inline void AddProgressBar( std::shared_ptr<TGProgressBar> myprog ){
 		prog = myprog;
@@ -42,6 +42,8 @@
 #include <vector>
 #include <iostream>
 #include <memory>
+#include <atomic>
+#include <thread>
 //#include <filesystem>
 
 
@@ -109,6 +111,7 @@ protected:
 	TGLabel				*lab_cal_file;		// label for calibration file
 	TGLabel				*lab_rea_file;		// label for reaction file
 	TGLabel				*lab_out_file;		// label for output file
+	TGLabel				*lab_jobs;			// label for number of jobs
 	
 	// Run list box
 	TGListBox           *run_list_box;
@@ -126,6 +129,9 @@ protected:
 	TGCheckButton       *check_event;		// check button to rebuild events
 	TGCheckButton       *check_source;		// check button to rebuild events
 
+	// Number entries
+	TGNumberEntry       *num_jobs;			// number of files to convert at the same time
+
 	// Action buttons
 	TGTextButton        *but_sel;			// button to select files
 	TGTextButton        *but_add;			// button to add files
@@ -151,6 +157,7 @@ protected:
 	bool flag_convert;
 	bool flag_events;
 	bool flag_source;
+	int njobs;
 
 	
 public:
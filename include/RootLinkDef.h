@@ -3,10 +3,14 @@
 #pragma link off all classes;
 #pragma link off all functions;
 #pragma link C++ class FebexMWD+;
+#pragma link C++ class FebexMWDBatch+;
 #pragma link C++ class Calibration+;
 #pragma link C++ class Settings+;
 #pragma link C++ class CommandLineInterface+;
 #pragma link C++ class Converter+;
+#pragma link C++ class BlockIndex+;
+#pragma link C++ class CompressedFile+;
+#pragma link C++ class BlockReader+;
 #pragma link C++ class TimeSorter+;
 #pragma link C++ class EventBuilder+;
 #pragma link C++ class MiniballGeometry+;
@@ -18,6 +22,9 @@
 #pragma link C++ class SpedeEvt+;
 #pragma link C++ class DataPackets+;
 #pragma link C++ class FebexData+;
+#pragma read sourceClass="FebexData" version="[1]" targetClass="FebexData" \
+	source="std::vector<unsigned short> trace" target="trace,trace_length" \
+	code="{ trace = onfile.trace; trace_length = onfile.trace.size(); }"
 #pragma link C++ class InfoData+;
 #pragma link C++ class Reaction+;
 #pragma link C++ class Particle+;
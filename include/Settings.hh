@@ -10,6 +10,26 @@
 #include "TSystem.h"
 #include "TEnv.h"
 
+class ConfigCache;
+
+/// What is plugged in to one FEBEX channel. It's made from the channel maps
+/// when the settings are read, so that a hit needs just one lookup.
+struct ChannelDescriptor {
+	
+	// Detector types, in the order the maps are checked
+	enum det_t : unsigned char {
+		DET_NONE,
+		DET_MINIBALL,	// id = cluster, crystal, segment
+		DET_CD,			// id = detector, sector, side, strip
+		DET_BEAMDUMP,	// id = detector
+		DET_SPEDE		// id = segment
+	};
+	
+	det_t type;		///< which detector, if any
+	short id[4];	///< IDs within the detector, -1 if not used
+	
+};
+
 /// A class to read in the settings file in ROOT's TConfig format.
 /// This has the number of modules, channels and things
 /// It also defines which detectors are which
@@ -66,6 +86,14 @@ public:
 	// Data settings
 	inline unsigned int GetBlockSize(){ return block_size; };
 	inline unsigned int IsFebexOnly(){ return flag_febex_only; };
+	inline unsigned int GetReadAheadBlocks(){ return read_ahead; };
+	inline unsigned int GetCheckpointBlocks(){ return checkpoint_blocks; };
+	
+	// Time sorting
+	inline unsigned long long GetSortMemory(){ return sort_memory * 1024ull * 1024ull; };
+	inline std::string GetSortScratchDir(){ return sort_dir; };
+	inline double GetSortWindow(){ return sort_window; };
+	inline bool IsFlatOutput(){ return flag_flat_output; };
 
 
 	// Miniball array
@@ -74,7 +102,7 @@ public:
 	inline unsigned int GetNumberOfMiniballSegments(){ return n_mb_segment; };
 	bool IsMiniball( unsigned int sfp, unsigned int board, unsigned int ch );
 	int GetMiniballID( unsigned int sfp, unsigned int board, unsigned int ch,
-					  std::vector<std::vector<std::vector<int>>> vector );
+					  const std::vector<std::vector<std::vector<int>>> &vector );
 	inline int GetMiniballCluster( unsigned int sfp, unsigned int board, unsigned int ch ){
 		return GetMiniballID( sfp, board, ch, mb_cluster );
 	};
@@ -94,7 +122,7 @@ public:
 	inline unsigned int GetNumberOfCDNStrips(){ return n_cd_nstrip; };
 	bool IsCD( unsigned int sfp, unsigned int board, unsigned int ch );
 	int GetCDID( unsigned int sfp, unsigned int board, unsigned int ch,
-					  std::vector<std::vector<std::vector<int>>> vector );
+					  const std::vector<std::vector<std::vector<int>>> &vector );
 	inline int GetCDDetector( unsigned int sfp, unsigned int board, unsigned int ch ){
 		return GetCDID( sfp, board, ch, cd_det );
 	};
@@ -119,11 +147,22 @@ public:
 	inline unsigned int GetNumberOfSpedeSegments(){ return n_spede_seg; };
 	bool IsSpede( unsigned int sfp, unsigned int board, unsigned int ch );
 	int GetSpedeSegment( unsigned int sfp, unsigned int board, unsigned int ch );
+	
+	
+	// Everything about a channel at once, DET_NONE if it's not a real channel
+	inline const ChannelDescriptor& GetChannel( unsigned int sfp, unsigned int board, unsigned int ch ){
+		if( sfp < n_febex_sfp && board < n_febex_board && ch < n_febex_ch )
+			return channel_desc[ ( sfp * n_febex_board + board ) * n_febex_ch + ch ];
+		return no_channel;
+	};
 
-	ClassDef( Settings, 10 )
+	ClassDef( Settings, 12 )
 
 private:
 
+	// Binary copy of the file, see ConfigCache
+	void CacheSettings( ConfigCache &cache );
+
 	std::string fInputFile;
 
 	// FEBEX settings
@@ -179,6 +218,10 @@ private:
 	std::vector<unsigned int> spede_ch;						///< A list of channel numbers for each SPEDE segment
 	std::vector<std::vector<std::vector<int>>> spede_seg;	///< A channel map for the SPEDE segments (-1 if not a SPEDE, otherwise segment number)
 
+	// All the channel maps together, made from the ones above
+	std::vector<ChannelDescriptor> channel_desc;	//! index ( sfp * n_febex_board + board ) * n_febex_ch + ch
+	ChannelDescriptor no_channel;					//! for channels that don't exist
+
 
 	// Info code settings
 	unsigned int sync_code;				///< Medium significant bits of the timestamp are here
@@ -203,8 +246,16 @@ private:
 	double event_window;			///< Event builder time window in ns
 	
 	// Data format
-	unsigned int block_size;		///< not yet implemented, needs C++ style reading of data files
+	unsigned int block_size;		///< size of the data blocks in bytes, 0 to find it from the data
 	bool flag_febex_only;			///< when there is only FEBEX data in the file
+	unsigned int read_ahead;		///< blocks read ahead on another thread, 0 to map the file if we can
+	unsigned int checkpoint_blocks;	///< blocks between checkpoints of the conversion, 0 for none
+	
+	// Time sorting
+	unsigned int sort_memory;		///< memory for hits waiting to be sorted in MB, before writing to disk
+	std::string sort_dir;			///< directory for the sorted chunks, same as the output if empty
+	double sort_window;				///< maximum disorder in ns for the streaming sort, 0 for a full sort
+	bool flag_flat_output;			///< write flat branches for each hit instead of DataPackets
 
 	
 };
@@ -0,0 +1,34 @@
+#ifndef __TRACECODEC_HH
+#define __TRACECODEC_HH
+
+#include <vector>
+
+// Compression of the FEBEX trace samples. Neighbouring samples are close
+// together, so we store the first sample and then the differences between
+// samples, bit packed in groups of TraceCodec::group_size. Each group has
+// one byte with the number of bits used for every difference in the group,
+// then the differences, zigzag encoded so that small negative numbers
+// are small too. A flat baseline costs almost nothing.
+class TraceCodec {
+
+public:
+
+	TraceCodec() {};
+	~TraceCodec() {};
+
+	// Number of differences sharing the same bit width
+	static const unsigned int group_size = 32;
+
+	static void Encode( const unsigned short *samples, unsigned int nsamples,
+					   std::vector<unsigned char> &packed );
+	static bool Decode( const unsigned char *packed, unsigned int nbytes,
+					   unsigned short *samples, unsigned int nsamples );
+
+	// Bytes needed in the worst case
+	static inline unsigned int GetMaxSize( unsigned int nsamples ){
+		return 2 + ( nsamples / group_size + 1 ) * ( 1 + 17 * group_size / 8 );
+	};
+
+};
+
+#endif
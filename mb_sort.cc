@@ -7,6 +7,7 @@
 #include "Histogrammer.hh"
 #include "DataSpy.hh"
 #include "MiniballGUI.hh"
+#include "ConfigWatcher.hh"
 
 // ROOT include.
 #include <TTree.h>
@@ -23,6 +24,8 @@
 #include <vector>
 #include <sstream>
 #include <memory>
+#include <atomic>
+#include <thread>
 
 // Command line interface
 #ifndef __COMMAND_LINE_INTERFACE_HH
@@ -62,6 +65,17 @@ int open_spy_data = -1;
 bool flag_monitor = false;
 int mon_time = -1; // update time in seconds
 
+// Number of threads for decoding blocks in the Converter
+int nthreads = 1;
+
+// Number of files to convert at the same time
+int njobs = 1;
+
+// Block index of the input files, to convert only a time window or some boards
+bool flag_index = false;
+std::vector<long long> time_window;
+std::vector<int> board_list;
+
 // Settings file
 std::shared_ptr<Settings> myset;
 
@@ -72,6 +86,11 @@ bool overwrite_cal = false;
 // Reaction file
 std::shared_ptr<Reaction> myreact;
 
+// Calibration and reaction read again when their files change during
+// monitoring, waiting to be swapped in between two passes of the loop
+std::shared_ptr<Calibration> newcal;
+std::shared_ptr<Reaction> newreact;
+
 // Struct for passing to the thread
 typedef struct thptr {
 	
@@ -85,6 +104,7 @@ typedef struct thptr {
 std::unique_ptr<THttpServer> serv;
 Bool_t bRunMon = kTRUE;
 Bool_t bFirstRun = kTRUE;
+Bool_t bResetOnReload = kFALSE;
 std::string curFileMon;
 int port_num = 8030;
 
@@ -96,19 +116,16 @@ void* monitor_run( void* ptr ){
 
 	// This function is called to run when monitoring
 	Converter conv_mon( calfiles->myset );
+	conv_mon.SetNumberOfThreads( nthreads );
 	EventBuilder eb_mon( calfiles->myset );
 	Histogrammer hist_mon( calfiles->myreact, calfiles->myset );
 
-	// Data blocks for Data spy
-	if( flag_spy && myset->GetBlockSize() != 0x10000 ) {
-	
-		// only 64 kB supported atm
-		std::cerr << "Currently only supporting 64 kB block size" << std::endl;
-		exit(1);
-	
-	}
+	// Data blocks for Data spy, big enough for any block if we have
+	// to find the block size from the data
+	unsigned int spy_block_size = calfiles->myset->GetBlockSize();
+	if( spy_block_size == 0 ) spy_block_size = 0x100000;
 	DataSpy myspy;
-	long long buffer[8*1024];
+	std::vector<long long> buffer( spy_block_size / sizeof(long long) );
 	int file_id = 0; ///> TapeServer volume = /dev/file/<id> ... <id> = 0 on issdaqpc2
 	if( flag_spy ) myspy.Open( file_id ); /// open the data spy
 	int spy_length = 0;
@@ -138,11 +155,32 @@ void* monitor_run( void* ptr ){
 	// While the sort is running, bRunMon is true
 	while( bRunMon ) {
 		
+		// Swap in a calibration or reaction that was read again since the
+		// last pass. Nothing is being processed now, so the whole pass is
+		// done with the old one or the new one, never a mix of both.
+		std::shared_ptr<Calibration> cal_reload = std::atomic_exchange( &newcal, std::shared_ptr<Calibration>() );
+		std::shared_ptr<Reaction> react_reload = std::atomic_exchange( &newreact, std::shared_ptr<Reaction>() );
+		if( cal_reload ) {
+			
+			conv_mon.AddCalibration( cal_reload );
+			if( bResetOnReload ) conv_mon.ResetCalHists();
+			
+		}
+		if( react_reload ) hist_mon.AddReaction( react_reload );
+		
+		// The events and their spectra depend on both of them
+		if( ( cal_reload || react_reload ) && bResetOnReload && !bFirstRun )
+			hist_mon.ResetHists();
+		
 		// Convert - from file
 		if( !flag_spy ) {
 			
+			// Only the blocks written since the last pass are converted
 			nblocks = conv_mon.ConvertFile( curFileMon, start_block );
-			start_block = nblocks;
+			if( nblocks > 0 ) start_block = nblocks;
+
+			// Sort the packets we just got, then do the rest of the analysis
+			conv_mon.SortTree();
 
 		}
 		
@@ -151,7 +189,7 @@ void* monitor_run( void* ptr ){
 		
 			// First check if we have data
 			std::cout << "Looking for data from DataSpy" << std::endl;
-			spy_length = myspy.Read( file_id, (char*)buffer, calfiles->myset->GetBlockSize() );
+			spy_length = myspy.Read( file_id, (char*)buffer.data(), spy_block_size );
 			if( spy_length == 0 && bFirstRun ) {
 				  std::cout << "No data yet on first pass" << std::endl;
 				  gSystem->Sleep( 2e3 );
@@ -162,11 +200,11 @@ void* monitor_run( void* ptr ){
 			while( spy_length ){
 			
 				std::cout << "Got some data from DataSpy" << std::endl;
-				nblocks = conv_mon.ConvertBlock( (char*)buffer, 0 );
+				nblocks = conv_mon.ConvertBlock( (char*)buffer.data(), spy_length, 0 );
 
 				// Read a new block
 				//gSystem->Sleep( 10 ); // wait 10 ms
-				spy_length = myspy.Read( file_id, (char*)buffer, calfiles->myset->GetBlockSize() );
+				spy_length = myspy.Read( file_id, (char*)buffer.data(), spy_block_size );
 
 			}
 
@@ -174,6 +212,9 @@ void* monitor_run( void* ptr ){
 			conv_mon.SortTree();
 		
 		}
+		
+		// Put the latest counts in the spectra
+		conv_mon.UpdateHists();
 										 
 		// Only do the rest if it is not a source run
 		if( !flag_source ) {
@@ -249,10 +290,16 @@ void start_http(){
 	// register simple start/stop commands
 	serv->RegisterCommand("/Start", "bRunMon=kTRUE;", "button;/usr/share/root/icons/ed_execute.png");
 	serv->RegisterCommand("/Stop",  "bRunMon=kFALSE;", "button;/usr/share/root/icons/ed_interrupt.png");
+	
+	// empty the spectra, or keep adding to them, when the calibration or reaction changes
+	serv->RegisterCommand("/ResetOnReload", "bResetOnReload=kTRUE;", "button;/usr/share/root/icons/ed_delete.png");
+	serv->RegisterCommand("/KeepOnReload",  "bResetOnReload=kFALSE;", "button;/usr/share/root/icons/ed_new.png");
 
 	// hide commands so the only show as buttons
 	serv->Hide("/Start");
 	serv->Hide("/Stop");
+	serv->Hide("/ResetOnReload");
+	serv->Hide("/KeepOnReload");
 		
 	// Add data directory
 	if( datadir_name.size() > 0 ) serv->AddLocation( "data/", datadir_name.data() );
@@ -261,18 +308,49 @@ void start_http(){
 	
 }
 
+// Convert one file, each with its own Converter so that
+// more than one can run at the same time
+void convert_file( std::string name_input_file, std::string name_output_file, bool flag_job ) {
+	
+	Converter conv( myset );
+	conv.SetNumberOfThreads( nthreads );
+	if( flag_job ) conv.SetJobName( name_input_file );
+	
+	// Block index and the parts of the file to convert with it
+	conv.SetWriteIndex( flag_index );
+	for( unsigned int i = 0; i + 1 < board_list.size(); i += 2 )
+		conv.SelectBoard( board_list[i], board_list[i+1] );
+
+	// Carry on from where an interrupted conversion stopped, if we can
+	if( flag_convert || !conv.ResumeOutput( name_output_file ) )
+		conv.SetOutput( name_output_file, true );
+	conv.MakeTree();
+	conv.MakeHists();
+	conv.AddCalibration( mycal );
+	if( time_window.size() == 2 )
+		conv.ConvertTimeWindow( name_input_file, time_window[0], time_window[1] );
+	else conv.ConvertFile( name_input_file );
+
+	// Sort the hits in to the tree before writing and closing
+	conv.SortTree();
+	conv.CloseOutput();
+	
+	return;
+	
+}
+
 void do_convert() {
 	
 	//------------------------//
 	// Run conversion to ROOT //
 	//------------------------//
-	Converter conv( myset );
 	std::cout << "\n +++ Miniball Analysis:: processing Converter +++" << std::endl;
 
 	TFile *rtest;
 	std::ifstream ftest;
 	std::string name_input_file;
 	std::string name_output_file;
+	std::vector<unsigned int> convert_list;
 	
 	// Check each file
 	for( unsigned int i = 0; i < input_names.size(); i++ ){
@@ -301,6 +379,16 @@ void do_convert() {
 			ftest.close();
 			rtest = new TFile( name_output_file.data() );
 			if( rtest->IsZombie() ) force_convert.at(i) = true;
+			
+			// An interrupted conversion still has its checkpoint
+			ftest.open( ( name_output_file + ".ckpt" ).data() );
+			if( ftest.is_open() ) {
+				
+				ftest.close();
+				force_convert.at(i) = true;
+				
+			}
+			
 			if( !flag_convert && !force_convert.at(i) )
 				std::cout << name_output_file << " already converted" << std::endl;
 			rtest->Close();
@@ -311,20 +399,47 @@ void do_convert() {
 			
 			std::cout << name_input_file << " --> ";
 			std::cout << name_output_file << std::endl;
+			convert_list.push_back( i );
 			
-			conv.SetOutput( name_output_file );
-			conv.MakeTree();
-			conv.MakeHists();
-			conv.AddCalibration( mycal );
-			conv.ConvertFile( name_input_file );
-
-			// Sort the tree before writing and closing
-			if( !flag_source ) conv.SortTree();
-			conv.CloseOutput();
-
 		}
 		
 	}
+	
+	// One file after another
+	unsigned int njobs_used = njobs > 1 ? njobs : 1;
+	if( njobs_used > convert_list.size() ) njobs_used = convert_list.size();
+	if( njobs_used <= 1 ) {
+		
+		for( unsigned int i = 0; i < convert_list.size(); i++ )
+			convert_file( input_names.at( convert_list[i] ),
+						  input_names.at( convert_list[i] ) + ".root", false );
+		
+		return;
+		
+	}
+	
+	// Or a pool of jobs, each taking the next file in the list until
+	// they're all done. The settings and calibration are only read,
+	// so they're shared by everyone.
+	std::cout << " Converting " << convert_list.size() << " files, ";
+	std::cout << njobs_used << " at a time" << std::endl;
+	ROOT::EnableThreadSafety();
+	
+	std::atomic<unsigned int> next_file( 0 );
+	std::vector<std::thread> jobs;
+	for( unsigned int j = 0; j < njobs_used; j++ ) {
+		
+		jobs.emplace_back( [&convert_list,&next_file](){
+			unsigned int k;
+			while( ( k = next_file++ ) < convert_list.size() )
+				convert_file( input_names.at( convert_list[k] ),
+							  input_names.at( convert_list[k] ) + ".root", true );
+		} );
+		
+	}
+	
+	for( unsigned int j = 0; j < jobs.size(); j++ )
+		jobs[j].join();
 
 	return;
 	
@@ -442,7 +557,12 @@ int main( int argc, char *argv[] ){
 	interface->Add("-spy", "Flag to run the DataSpy", &flag_spy );
 	interface->Add("-m", "Monitor input file every X seconds", &mon_time );
 	interface->Add("-p", "Port number for web server (default 8030)", &port_num );
+	interface->Add("-t", "Number of threads to decode data blocks (default 1)", &nthreads );
+	interface->Add("-j", "Number of files to convert at the same time (default 1)", &njobs );
 	interface->Add("-d", "Data directory to add to the monitor", &datadir_name );
+	interface->Add("-idx", "Write a block index next to each input file", &flag_index );
+	interface->Add("-tw", "Only convert the blocks with hits between two timestamps", &time_window );
+	interface->Add("-b", "Only convert the blocks with hits from these boards, as SFP and board pairs", &board_list );
 	interface->Add("-g", "Launch the GUI", &gui_flag );
 	interface->Add("-h", "Print this help", &help_flag );
 
@@ -498,6 +618,30 @@ int main( int argc, char *argv[] ){
 				
 	}
 	
+	// Converting part of the input needs the block index, which can't
+	// be done while the file is still being written
+	if( time_window.size() || board_list.size() ) {
+		
+		if( ( time_window.size() && time_window.size() != 2 ) || board_list.size() % 2 ) {
+			
+			std::cout << "Give two timestamps with -tw and pairs of SFP and board with -b" << std::endl;
+			return 1;
+			
+		}
+		
+		if( flag_monitor ) {
+			
+			std::cout << "Cannot convert part of a file when monitoring" << std::endl;
+			return 1;
+			
+		}
+		
+		// The output only has part of the data, so don't use an old one
+		std::cout << "Converting only part of the input, using the block index" << std::endl;
+		flag_convert = true;
+		
+	}
+	
 	// Check the ouput file name
 	if( output_name.length() == 0 )
 		output_name = input_names.at(0) + "_hists.root";
@@ -562,6 +706,22 @@ int main( int argc, char *argv[] ){
 		// Start the HTTP server from the main thread (should usually do this)
 		start_http();
 		gSystem->ProcessEvents();
+		
+		// Read the calibration and reaction files again when they change.
+		// This is done on the watcher's thread, so the monitor loop only
+		// has to swap them in. The spectra carry on filling, unless the
+		// ResetOnReload button was pressed.
+		ROOT::EnableThreadSafety();
+		ConfigWatcher watcher;
+		if( overwrite_cal ) watcher.Watch( name_cal_file, [](){
+			std::cout << "Calibration file changed, reading it again" << std::endl;
+			std::atomic_store( &newcal, std::make_shared<Calibration>( name_cal_file, myset ) );
+		} );
+		if( name_react_file != "dummy" ) watcher.Watch( name_react_file, [](){
+			std::cout << "Reaction file changed, reading it again" << std::endl;
+			std::atomic_store( &newreact, std::make_shared<Reaction>( name_react_file, myset ) );
+		} );
+		watcher.Start();
 
 		// Thread for the monitor process
 		TThread *th = new TThread( "monitor", monitor_run, &data );
@@ -0,0 +1,94 @@
+#include "../include/DataPackets.hh"
+#include "../include/Calibration.hh"
+
+void mwd_batch( std::string filename = "test/R4_13.root", unsigned int sfp = 0,
+			   unsigned board = 0, unsigned int ch = 0, std::string calfile = "default" ) {
+	
+	// Open file
+	TFile *f = new TFile( filename.data() );
+	
+	// Get Tree
+	TTree *t = (TTree*)f->Get("mb_sort");
+	
+	// Settings file - needed for calibration, just use defaults
+	std::shared_ptr<Settings> myset = std::make_shared<Settings>( "default" );
+	
+	// Calibration file
+	Calibration *cal = new Calibration( calfile.data(), myset );
+	
+	// Get entries
+	unsigned long long nentries = t->GetEntries();
+	
+	// Branches, etc
+	std::shared_ptr<FebexData> febex;
+	DataPackets *data = new DataPackets;
+	t->SetBranchAddress( "data", &data );
+	
+	// Energy histogram
+	TH1F *h = new TH1F( "mwd_energy", "Energy spectrum", 65536, -0.5, 65535.5 );
+	
+	// Traces are done this many at a time, all with the same length
+	const unsigned int batch_size = 4096;
+	FebexMWDBatch batch;
+	
+	// Loop
+	for( unsigned long long i = 0; i < nentries; ++i ){
+		
+		// Get entry
+		t->GetEntry(i);
+		
+		// Check if it is FebexData
+		if( !data->IsFebex() ) continue;
+		
+		// If it is febex, get the data packet
+		febex = data->GetFebexData();
+		
+		// Check if it matches the channel we want
+		if( febex->GetSfp() != sfp ||
+		    febex->GetBoard() != board ||
+		    febex->GetChannel() != ch ||
+		    febex->GetTraceLength() == 0 ) continue;
+		
+		// Run the MWD when the batch is full, or the trace length changes
+		if( batch.NumberOfTraces() == batch_size ||
+		    batch.GetTraceLength() != febex->GetTraceLength() ) {
+			
+			cal->DoMWD( sfp, board, ch, batch );
+			for( unsigned int j = 0; j < batch.GetEnergies().size(); ++j )
+				h->Fill( batch.GetEnergies()[j] );
+			
+			batch.Reset( febex->GetTraceLength() );
+			
+		}
+		
+		batch.AddTrace( febex->GetTrace() );
+		
+		// Progress bar
+		if( i % 100000 == 0 || i+1 == nentries ) {
+			
+			std::cout << " " << std::setw(8) << std::setprecision(4);
+			std::cout << (float)(i+1)*100.0/(float)nentries << "%    \r";
+			std::cout.flush();
+			
+		}
+		
+	} // nentries loop
+	
+	// Whatever is left
+	cal->DoMWD( sfp, board, ch, batch );
+	for( unsigned int j = 0; j < batch.GetEnergies().size(); ++j )
+		h->Fill( batch.GetEnergies()[j] );
+	std::cout << std::endl;
+	
+	// Draw energy histogram
+	TCanvas *c1 = new TCanvas( "c1", filename.data(), 900, 600 );
+	if( h->Integral() > 50 )
+		h->GetXaxis()->SetRangeUser(
+				h->GetMean() - 10.* h->GetStdDev(),
+				h->GetMean() + 10.* h->GetStdDev() );
+	h->Draw("hist");
+	c1->Update();
+	
+	return;
+	
+}
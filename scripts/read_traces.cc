@@ -6,7 +6,7 @@ void read_traces( std::string filename = "test/R4_13.root" ) {
 	TFile *f = new TFile( filename.data() );
 	
 	// Get Tree
-	TTree *t = (TTree*)f->Get("mb");
+	TTree *t = (TTree*)f->Get("mb_sort");
 	
 	// Get entries
 	unsigned long long nentries = t->GetEntries();
@@ -0,0 +1,157 @@
+#include "BlockIndex.hh"
+
+// Sidecar file format, change the version if the layout changes
+static const char index_magic[] = "MBIDX001";
+
+BlockIndex::BlockIndex( unsigned int nsfp, unsigned int nboard ) {
+
+	n_sfp = nsfp;
+	n_board = nboard;
+	block_size = 0x10000;
+	file_size = 0;
+	file_mtime = 0;
+
+}
+
+void BlockIndex::Clear() {
+
+	entries.clear();
+	hits.clear();
+	file_size = 0;
+	file_mtime = 0;
+
+	return;
+
+}
+
+// Add the next block, with the number of hits for every SFP and board
+void BlockIndex::AddBlock( const BlockIndexEntry &entry, const std::vector<UInt_t> &block_hits ){
+
+	entries.push_back( entry );
+
+	for( unsigned int i = 0; i < n_sfp * n_board; ++i ) {
+
+		if( i < block_hits.size() ) hits.push_back( block_hits[i] );
+		else hits.push_back( 0 );
+
+	}
+
+	return;
+
+}
+
+// Read the index from a sidecar file.
+// Returns false if it doesn't exist or was made with different settings.
+bool BlockIndex::ReadIndex( std::string index_file_name ){
+
+	std::ifstream index_file( index_file_name, std::ios::in|std::ios::binary );
+	if( !index_file.is_open() ) return false;
+
+	// Check the file format
+	char magic[8];
+	index_file.read( magic, 8 );
+	if( !index_file.good() || std::string( magic, 8 ) != index_magic )
+		return false;
+
+	// Check the number of SFPs and boards match
+	UInt_t nsfp, nboard;
+	index_file.read( (char*)&nsfp, sizeof(nsfp) );
+	index_file.read( (char*)&nboard, sizeof(nboard) );
+	if( nsfp != n_sfp || nboard != n_board ) return false;
+
+	// Details of the data file that was indexed
+	ULong64_t nentries;
+	index_file.read( (char*)&block_size, sizeof(block_size) );
+	index_file.read( (char*)&file_size, sizeof(file_size) );
+	index_file.read( (char*)&file_mtime, sizeof(file_mtime) );
+	index_file.read( (char*)&nentries, sizeof(nentries) );
+	if( !index_file.good() ) return false;
+
+	// One entry for each block, so a damaged count isn't used to size anything
+	if( block_size == 0 || nentries != file_size / block_size ) {
+
+		std::cout << "Block index " << index_file_name << " is damaged" << std::endl;
+		Clear();
+		return false;
+
+	}
+
+	// Then all the entries and the hits
+	entries.resize( nentries );
+	hits.resize( nentries * n_sfp * n_board );
+	index_file.read( (char*)entries.data(), nentries * sizeof(BlockIndexEntry) );
+	index_file.read( (char*)hits.data(), hits.size() * sizeof(UInt_t) );
+
+	if( !index_file.good() ) {
+
+		std::cout << "Block index " << index_file_name << " is incomplete" << std::endl;
+		Clear();
+		return false;
+
+	}
+
+	index_file.close();
+
+	return true;
+
+}
+
+// Write the index to a sidecar file.
+// If we cannot write next to the data, we just carry on without it.
+bool BlockIndex::WriteIndex( std::string index_file_name ){
+
+	std::ofstream index_file( index_file_name, std::ios::out|std::ios::binary|std::ios::trunc );
+	if( !index_file.is_open() ) {
+
+		std::cout << "Cannot write block index to " << index_file_name << std::endl;
+		return false;
+
+	}
+
+	UInt_t nsfp = n_sfp;
+	UInt_t nboard = n_board;
+	ULong64_t nentries = entries.size();
+
+	index_file.write( index_magic, 8 );
+	index_file.write( (char*)&nsfp, sizeof(nsfp) );
+	index_file.write( (char*)&nboard, sizeof(nboard) );
+	index_file.write( (char*)&block_size, sizeof(block_size) );
+	index_file.write( (char*)&file_size, sizeof(file_size) );
+	index_file.write( (char*)&file_mtime, sizeof(file_mtime) );
+	index_file.write( (char*)&nentries, sizeof(nentries) );
+	index_file.write( (char*)entries.data(), nentries * sizeof(BlockIndexEntry) );
+	index_file.write( (char*)hits.data(), hits.size() * sizeof(UInt_t) );
+
+	index_file.close();
+
+	return true;
+
+}
+
+// Find the range of blocks with hits between tmin and tmax.
+// Hits from different boards are not strictly in time order within the
+// file, so this is the first block that ends after tmin to the last
+// block that starts before tmax.
+bool BlockIndex::FindTimeWindow( ULong64_t tmin, ULong64_t tmax,
+								unsigned long &first_block, unsigned long &last_block ){
+
+	bool flag_first = false;
+
+	for( unsigned long i = 0; i < entries.size(); ++i ) {
+
+		if( !( entries[i].flags & BLOCK_HITS ) ) continue;
+
+		if( !flag_first && entries[i].time_last >= tmin ) {
+
+			first_block = i;
+			flag_first = true;
+
+		}
+
+		if( entries[i].time_first <= tmax ) last_block = i;
+
+	}
+
+	return flag_first && first_block <= last_block;
+
+}
@@ -0,0 +1,211 @@
+#include "BlockReader.hh"
+
+#include <cerrno>
+#include <cstring>
+
+BlockReader::BlockReader(){
+
+	fd = -1;
+	flag_stream = false;
+	block_size = 0;
+	first_block = 0;
+	last_block = 0;
+	nbuffers = 0;
+	nread = 0;
+	ntaken = 0;
+	nreleased = 0;
+	flag_done = true;
+	flag_stop = false;
+
+}
+
+BlockReader::~BlockReader(){
+
+	Close();
+
+}
+
+bool BlockReader::Open( std::string input_file_name, unsigned int size,
+					   unsigned int n, unsigned long first,
+					   unsigned long last,
+					   const std::vector<unsigned long> &blocks ){
+
+	Close();
+
+	fd = open( input_file_name.data(), O_RDONLY );
+	if( fd < 0 ) return false;
+
+	struct stat input_stat;
+	flag_stream = fstat( fd, &input_stat ) != 0 || !S_ISREG( input_stat.st_mode );
+	file_name = input_file_name;
+
+	// Let the kernel read ahead as well
+	if( !flag_stream && blocks.empty() )
+		posix_fadvise( fd, 0, 0, POSIX_FADV_SEQUENTIAL );
+
+	block_size = size;
+
+	// Skip to the start of a stream
+	if( flag_stream ) {
+
+		std::vector<char> skip( block_size );
+		for( unsigned long i = 0; i < first; ++i ) {
+
+			if( !ReadBlock( skip.data(), i ) ) break;
+
+		}
+
+	}
+
+	first_block = first;
+	last_block = last;
+	block_list = blocks;
+
+	// At least double buffered
+	nbuffers = n > 2 ? n : 2;
+	ring.resize( (unsigned long)nbuffers * block_size );
+	ring_block.resize( nbuffers );
+	nread = 0;
+	ntaken = 0;
+	nreleased = 0;
+	flag_done = false;
+	flag_stop = false;
+	worker = std::thread( &BlockReader::ReadBlocks, this );
+
+	return true;
+
+}
+
+void BlockReader::Close(){
+
+	// Tell the thread to stop, even if the reader didn't get to the end
+	if( worker.joinable() ) {
+
+		{
+			std::lock_guard<std::mutex> lk( ring_lock );
+			flag_stop = true;
+		}
+		block_free.notify_all();
+		worker.join();
+
+	}
+
+	if( fd >= 0 ) close( fd );
+	fd = -1;
+	flag_done = true;
+
+	return;
+
+}
+
+const char* BlockReader::Next( unsigned long &nblock ){
+
+	std::unique_lock<std::mutex> lk( ring_lock );
+	block_ready.wait( lk, [this]{ return ntaken < nread || flag_done; } );
+	if( ntaken == nread ) return nullptr;
+
+	unsigned int slot = ntaken % nbuffers;
+	nblock = ring_block[slot];
+	ntaken++;
+
+	return ring.data() + (unsigned long)slot * block_size;
+
+}
+
+void BlockReader::Release(){
+
+	{
+		std::lock_guard<std::mutex> lk( ring_lock );
+		if( nreleased < ntaken ) nreleased++;
+	}
+	block_free.notify_one();
+
+	return;
+
+}
+
+// Read a whole block, false at the end of the file or on an error
+bool BlockReader::ReadBlock( char *data, unsigned long nblock ){
+
+	unsigned long long n = 0;
+	while( n < block_size ) {
+
+		ssize_t ret;
+		if( flag_stream ) ret = read( fd, data + n, block_size - n );
+		else ret = pread( fd, data + n, block_size - n,
+						 (off_t)nblock * block_size + n );
+
+		if( ret < 0 && errno == EINTR ) continue;
+		if( ret < 0 ) {
+
+			std::cout << "Error reading " << file_name << ": ";
+			std::cout << std::strerror( errno ) << std::endl;
+			return false;
+
+		}
+
+		// End of the file, a partial block is left for next time
+		if( ret == 0 ) return false;
+		n += ret;
+
+	}
+
+	return true;
+
+}
+
+// Thread that reads the blocks in to the ring, as long as there is space
+void BlockReader::ReadBlocks(){
+
+	unsigned long long i = 0;
+	while( true ) {
+
+		// Which block is next
+		unsigned long nblock;
+		if( block_list.size() ) {
+
+			if( i >= block_list.size() ) break;
+			nblock = block_list[i];
+
+		}
+
+		else {
+
+			nblock = first_block + i;
+			if( last_block > 0 && nblock >= last_block ) break;
+
+		}
+
+		// Wait for a free buffer
+		unsigned int slot;
+		{
+			std::unique_lock<std::mutex> lk( ring_lock );
+			block_free.wait( lk, [this]{ return nread - nreleased < nbuffers || flag_stop; } );
+			if( flag_stop ) break;
+			slot = nread % nbuffers;
+		}
+
+		// The buffer is ours until we say it's ready
+		if( !ReadBlock( ring.data() + (unsigned long)slot * block_size, nblock ) )
+			break;
+
+		{
+			std::lock_guard<std::mutex> lk( ring_lock );
+			ring_block[slot] = nblock;
+			nread++;
+		}
+		block_ready.notify_one();
+
+		i++;
+
+	}
+
+	{
+		std::lock_guard<std::mutex> lk( ring_lock );
+		flag_done = true;
+	}
+	block_ready.notify_all();
+
+	return;
+
+}
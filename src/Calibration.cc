@@ -1,9 +1,27 @@
 #include "Calibration.hh"
+#include "ConfigCache.hh"
 #include <stdio.h>
 
 ClassImp(FebexMWD)
+ClassImp(FebexMWDBatch)
 ClassImp(Calibration)
 
+DitherRandom::DitherRandom( unsigned long long seed ) {
+	
+	// splitmix64 to fill the state, it can't be all zero
+	for( unsigned int i = 0; i < 2; ++i ) {
+		
+		unsigned long long z = ( seed += 0x9E3779B97F4A7C15ULL );
+		z = ( z ^ ( z >> 30 ) ) * 0xBF58476D1CE4E5B9ULL;
+		z = ( z ^ ( z >> 27 ) ) * 0x94D049BB133111EBULL;
+		z ^= z >> 31;
+		s[2*i] = z & 0xFFFFFFFF;
+		s[2*i+1] = z >> 32;
+		
+	}
+	
+}
+
 void FebexMWD::DoMWD(std::string trace_name) {
 	
 	// Define the peaking time for this channel based on rise time then go to centre of flat top
@@ -12,20 +30,28 @@ void FebexMWD::DoMWD(std::string trace_name) {
 	// Get the trace length
 	unsigned int trace_length = trace.size();
 	
-	// resize vectors
-	stage1.resize( trace_length, 0.0 );
-	stage2.resize( trace_length, 0.0 );
-	stage3.resize( trace_length, 0.0 );
-	shaper.resize( trace_length, 0.0 );
-	cfd.resize( trace_length, 0.0 );
+	// Start again, but keep the memory from the last trace
+	energy_list.clear();
+	cfd_list.clear();
+	stage1.assign( trace_length, 0.0 );
+	stage2.assign( trace_length, 0.0 );
+	stage3.assign( trace_length, 0.0 );
+	shaper.assign( trace_length, 0.0 );
+	cfd.assign( trace_length, 0.0 );
+	
+	// Same for every sample
+	float decay_factor = 1.0 / decay_time;
+	decay_factor -= 1.0;
 	
+	// Sum of the stage 2 samples in the moving average window.
+	// It's kept as a double so it doesn't drift along the trace.
+	double stage2_sum = 0.0;
 	
 	// Loop over trace and analyse
 	for( unsigned int i = 1; i < trace_length; ++i ) {
 		
 		// MWD stage 1 - remove decay
-		stage1[i]  = 1.0 / decay_time;
-		stage1[i] -= 1.0;
+		stage1[i]  = decay_factor;
 		stage1[i] *= trace[i-1];
 		stage1[i] += trace[i];
 		stage1[i] += stage1[i-1];
@@ -38,13 +64,13 @@ void FebexMWD::DoMWD(std::string trace_name) {
 			
 		}
 		
-		// MWD stage 3 - moving average
+		// MWD stage 3 - moving average, as a running sum with the
+		// newest sample added and the one leaving the window taken off
+		stage2_sum += stage2[i];
 		if( i >= rise_time ) {
 			
-			for( unsigned int j = 0; j < rise_time; ++j )
-				stage3[i] += stage2[i-j];
-			
-			stage3[i] /= (float)rise_time;
+			stage2_sum -= stage2[i-rise_time];
+			stage3[i] = stage2_sum / (float)rise_time;
 
 		}
 		
@@ -69,7 +95,7 @@ void FebexMWD::DoMWD(std::string trace_name) {
 		    ( cfd[i] < threshold && threshold < 0 ) ) {
 			//
 			// Find zero crossing
-			while( cfd[i] * cfd[i-1] > 0 && i < trace_length ) i++;
+			while( i < trace_length && cfd[i] * cfd[i-1] > 0 ) i++;
 			
 			// Reject incorrect polarity
 			if( threshold < 0 && cfd[i-1] > 0 ) continue;
@@ -126,6 +152,221 @@ void FebexMWD::DoMWD(std::string trace_name) {
 
 
 
+void FebexMWDBatch::Reset( unsigned int length ) {
+	
+	ntraces = 0;
+	trace_length = length;
+	input.clear();
+	energy_list.clear();
+	cfd_list.clear();
+	first_trigger.assign( 1, 0 );
+	
+	return;
+	
+}
+
+bool FebexMWDBatch::AddTrace( const std::vector<unsigned short> &t ) {
+	
+	if( t.size() != trace_length ) return false;
+	
+	input.insert( input.end(), t.begin(), t.end() );
+	ntraces++;
+	
+	return true;
+	
+}
+
+void FebexMWDBatch::DoMWD() {
+	
+	energy_list.clear();
+	cfd_list.clear();
+	first_trigger.assign( 1, 0 );
+	
+	trace.resize( trace_length * lanes );
+	for( unsigned int first = 0; first < ntraces; first += lanes ) {
+		
+		// Swap the samples around so that the traces in the lanes are
+		// together for each sample. Spare lanes at the end are empty.
+		unsigned int nlanes = ntraces - first < lanes ? ntraces - first : lanes;
+		const unsigned short *in = input.data() + first * trace_length;
+		for( unsigned int l = 0; l < lanes; ++l )
+			for( unsigned int i = 0; i < trace_length; ++i )
+				trace[i*lanes+l] = l < nlanes ? in[l*trace_length+i] : 0;
+		
+		DoStages();
+		
+		// The triggers have to be found one trace at a time
+		for( unsigned int l = 0; l < nlanes; ++l ) {
+			
+			FindTriggers(l);
+			first_trigger.push_back( energy_list.size() );
+			
+		}
+		
+	}
+	
+	return;
+	
+}
+
+// Each step is the same as FebexMWD::DoMWD, so the answers are too.
+// Only the sample number is tested, so there's no branch inside
+// the loops over the lanes.
+void FebexMWDBatch::DoStages() {
+	
+	// Every sample is written below, apart from the first
+	stage1.resize( trace.size() );
+	stage2.resize( trace.size() );
+	stage3.resize( trace.size() );
+	shaper.resize( trace.size() );
+	cfd.resize( trace.size() );
+	for( unsigned int l = 0; l < lanes; ++l )
+		stage1[l] = stage2[l] = stage3[l] = shaper[l] = cfd[l] = 0.0;
+	
+	// Same for every sample
+	float decay_factor = 1.0 / decay_time;
+	decay_factor -= 1.0;
+	
+	// Moving average sum for each lane
+	double stage2_sum[lanes];
+	for( unsigned int l = 0; l < lanes; ++l )
+		stage2_sum[l] = 0.0;
+	
+	for( unsigned int i = 1; i < trace_length; ++i ) {
+		
+		const float *x = trace.data() + i*lanes;
+		float *s1 = stage1.data() + i*lanes;
+		float *s2 = stage2.data() + i*lanes;
+		float *s3 = stage3.data() + i*lanes;
+		
+		// MWD stage 1 - remove decay
+		const float *x_last = x - lanes;
+		const float *s1_last = s1 - lanes;
+		for( unsigned int l = 0; l < lanes; ++l ) {
+			
+			float y = decay_factor;
+			y *= x_last[l];
+			y += x[l];
+			y += s1_last[l];
+			s1[l] = y;
+			
+		}
+		
+		// MWD stage 2 - difference
+		if( i > flat_top ) {
+			
+			const float *s1_top = s1 - flat_top*lanes;
+			for( unsigned int l = 0; l < lanes; ++l )
+				s2[l] = s1[l] - s1_top[l];
+			
+		}
+		
+		else for( unsigned int l = 0; l < lanes; ++l )
+			s2[l] = 0.0;
+		
+		// MWD stage 3 - moving average, as a running sum
+		for( unsigned int l = 0; l < lanes; ++l )
+			stage2_sum[l] += s2[l];
+		
+		if( i >= rise_time ) {
+			
+			const float *s2_rise = s2 - rise_time*lanes;
+			for( unsigned int l = 0; l < lanes; ++l ) {
+				
+				stage2_sum[l] -= s2_rise[l];
+				s3[l] = stage2_sum[l] / (float)rise_time;
+				
+			}
+			
+		}
+		
+		else for( unsigned int l = 0; l < lanes; ++l )
+			s3[l] = 0.0;
+		
+		// CFD
+		if( i >= delay_time ) {
+			
+			const float *x_delay = x - delay_time*lanes;
+			float *sh = shaper.data() + i*lanes;
+			const float *sh_delay = sh - delay_time*lanes;
+			float *c = cfd.data() + i*lanes;
+			for( unsigned int l = 0; l < lanes; ++l ) {
+				
+				sh[l] = x[l] - x_delay[l];
+				c[l]  = fraction * sh[l];
+				c[l] -= sh_delay[l];
+				
+			}
+			
+		}
+		
+		else for( unsigned int l = 0; l < lanes; ++l )
+			shaper[i*lanes+l] = cfd[i*lanes+l] = 0.0;
+		
+	} // loop over samples
+	
+	return;
+	
+}
+
+// Same as the second half of FebexMWD::DoMWD, for the trace in lane l
+void FebexMWDBatch::FindTriggers( unsigned int l ) {
+	
+	// Define the peaking time for this channel based on rise time then go to centre of flat top
+	float peaking_time = flat_top - (float)rise_time * fraction;
+	
+	// Samples of this trace are lanes apart
+	const unsigned int n = lanes;
+	const float *c = cfd.data() + l;
+	const float *s3 = stage3.data() + l;
+	
+	// Loop now over the CFD trace until we trigger
+	for( unsigned int i = delay_time*2+1; i < trace_length; ++i ) {
+		
+		// Trigger when we pass the threshold on the CFD
+		if( ( c[i*n] > threshold && threshold > 0 ) ||
+		    ( c[i*n] < threshold && threshold < 0 ) ) {
+			
+			// Find zero crossing
+			while( i < trace_length && c[i*n] * c[(i-1)*n] > 0 ) i++;
+			
+			// Reject incorrect polarity
+			if( threshold < 0 && c[(i-1)*n] > 0 ) continue;
+			if( threshold > 0 && c[(i-1)*n] < 0 ) continue;
+			
+			// Check we have enough trace left to analyse
+			if( trace_length - i < peaking_time + window/2 )
+				break;
+			
+			// Mark the CFD time
+			float cfd_time = (float)i / c[i*n];
+			cfd_time += (float)(i-1) / c[(i-1)*n];
+			cfd_time /= 1.0 / c[i*n] + 1.0 / c[(i-1)*n];
+			cfd_list.push_back( cfd_time );
+			
+			// move to peak of the flat top, then back to the start of the window
+			i += peaking_time;
+			i -= window;
+			
+			// average energy over window
+			float energy = 0.0;
+			for( unsigned int j = i; j < i + window; ++j )
+				energy += s3[j*n];
+			
+			energy_list.push_back( TMath::Abs(energy) / (float)window );
+			
+			// move back to the peak, then to the end of the trapezoid
+			i += peaking_time/2;
+			
+		} // threshold passed
+		
+	} // loop over CFD
+	
+	return;
+	
+}
+
+
 Calibration::Calibration() {
 
 	SetFile( "dummy" );
@@ -144,6 +385,21 @@ Calibration::Calibration( std::string filename, std::shared_ptr<Settings> myset
 
 void Calibration::ReadCalibration() {
 
+	// Everything from last time, if the file hasn't changed since.
+	// It depends on the number of channels in the settings too.
+	unsigned long long key = Class_Version();
+	key = ( key << 16 ) | set->GetNumberOfFebexSfps();
+	key = ( key << 16 ) | set->GetNumberOfFebexBoards();
+	key = ( key << 16 ) | set->GetNumberOfFebexChannels();
+	
+	ConfigCache cache( fInputFile, key );
+	if( cache.Load() ) {
+		
+		CacheCalibration( cache );
+		if( cache.IsGood() ) return;
+		
+	}
+
 	std::unique_ptr<TEnv> config( new TEnv( fInputFile.data() ) );
 	
 	default_MWD_Decay		= 14000.0;
@@ -155,151 +411,181 @@ void Calibration::ReadCalibration() {
 	default_CFD_Fraction	= 0.5;
 
 	
-	// FEBEX initialisation
-	fFebexOffset.resize( set->GetNumberOfFebexSfps() );
-	fFebexGain.resize( set->GetNumberOfFebexSfps() );
-	fFebexGainQuadr.resize( set->GetNumberOfFebexSfps() );
-	fFebexThreshold.resize( set->GetNumberOfFebexSfps() );
-	fFebexTime.resize( set->GetNumberOfFebexSfps() );
-	fFebexMWD_Decay.resize( set->GetNumberOfFebexSfps() );
-	fFebexMWD_Rise.resize( set->GetNumberOfFebexSfps() );
-	fFebexMWD_Top.resize( set->GetNumberOfFebexSfps() );
-	fFebexMWD_Window.resize( set->GetNumberOfFebexSfps() );
-	fFebexCFD_Delay.resize( set->GetNumberOfFebexSfps() );
-	fFebexCFD_Threshold.resize( set->GetNumberOfFebexSfps() );
-	fFebexCFD_Fraction.resize( set->GetNumberOfFebexSfps() );
+	// FEBEX initialisation, one entry for each channel
+	fFebexCal.resize( set->GetNumberOfFebexSfps() *
+					 set->GetNumberOfFebexBoards() *
+					 set->GetNumberOfFebexChannels() );
 
 	// FEBEX parameter read
 	for( unsigned int i = 0; i < set->GetNumberOfFebexSfps(); i++ ){
 
-		fFebexOffset[i].resize( set->GetNumberOfFebexBoards() );
-		fFebexGain[i].resize( set->GetNumberOfFebexBoards() );
-		fFebexGainQuadr[i].resize( set->GetNumberOfFebexBoards() );
-		fFebexThreshold[i].resize( set->GetNumberOfFebexBoards() );
-		fFebexTime[i].resize( set->GetNumberOfFebexBoards() );
-		fFebexMWD_Decay[i].resize( set->GetNumberOfFebexBoards() );
-		fFebexMWD_Rise[i].resize( set->GetNumberOfFebexBoards() );
-		fFebexMWD_Top[i].resize( set->GetNumberOfFebexBoards() );
-		fFebexMWD_Window[i].resize( set->GetNumberOfFebexBoards() );
-		fFebexCFD_Delay[i].resize( set->GetNumberOfFebexBoards() );
-		fFebexCFD_Threshold[i].resize( set->GetNumberOfFebexBoards() );
-		fFebexCFD_Fraction[i].resize( set->GetNumberOfFebexBoards() );
-
 		for( unsigned int j = 0; j < set->GetNumberOfFebexBoards(); j++ ){
 
-			fFebexOffset[i][j].resize( set->GetNumberOfFebexChannels() );
-			fFebexGain[i][j].resize( set->GetNumberOfFebexChannels() );
-			fFebexGainQuadr[i][j].resize( set->GetNumberOfFebexChannels() );
-			fFebexThreshold[i][j].resize( set->GetNumberOfFebexChannels() );
-			fFebexTime[i][j].resize( set->GetNumberOfFebexChannels() );
-			fFebexMWD_Decay[i][j].resize( set->GetNumberOfFebexChannels() );
-			fFebexMWD_Rise[i][j].resize( set->GetNumberOfFebexChannels() );
-			fFebexMWD_Top[i][j].resize( set->GetNumberOfFebexChannels() );
-			fFebexMWD_Window[i][j].resize( set->GetNumberOfFebexChannels() );
-			fFebexCFD_Delay[i][j].resize( set->GetNumberOfFebexChannels() );
-			fFebexCFD_Threshold[i][j].resize( set->GetNumberOfFebexChannels() );
-			fFebexCFD_Fraction[i][j].resize( set->GetNumberOfFebexChannels() );
-
 			for( unsigned int k = 0; k < set->GetNumberOfFebexChannels(); k++ ){
 				
-				fFebexOffset[i][j][k] = config->GetValue( Form( "febex_%d_%d_%d.Offset", i, j, k ), 0. );
-				fFebexGain[i][j][k] = config->GetValue( Form( "febex_%d_%d_%d.Gain", i, j, k ), 1. );
-				fFebexGainQuadr[i][j][k] = config->GetValue( Form( "febex_%d_%d_%d.GainQuadr", i, j, k ), 0. );
-				fFebexThreshold[i][j][k] = config->GetValue( Form( "febex_%d_%d_%d.Threshold", i, j, k ), 0. );
-				fFebexTime[i][j][k] = config->GetValue( Form( "febex_%d_%d_%d.Time", i, j, k ), 0 );
-				fFebexMWD_Decay[i][j][k] = config->GetValue( Form( "febex_%d_%d_%d.MWD.DecayTime", i, j, k ), default_MWD_Decay );
-				fFebexMWD_Rise[i][j][k] = config->GetValue( Form( "febex_%d_%d_%d.MWD.RiseTime", i, j, k ), (int)default_MWD_Rise );
-				fFebexMWD_Top[i][j][k] = config->GetValue( Form( "febex_%d_%d_%d.MWD.FlatTop", i, j, k ), (int)default_MWD_Top );
-				fFebexMWD_Window[i][j][k] = config->GetValue( Form( "febex_%d_%d_%d.MWD.Window", i, j, k ), (int)default_MWD_Window );
-				fFebexCFD_Delay[i][j][k] = config->GetValue( Form( "febex_%d_%d_%d.CFD.DelayTime", i, j, k ), (int)default_CFD_Delay );
-				fFebexCFD_Threshold[i][j][k] = config->GetValue( Form( "febex_%d_%d_%d.CFD.Threshold", i, j, k ), (int)default_CFD_Threshold );
-				fFebexCFD_Fraction[i][j][k] = config->GetValue( Form( "febex_%d_%d_%d.CFD.Fraction", i, j, k ), default_CFD_Fraction );
+				FebexChannelCal &c = fFebexCal[ GetFebexIndex( i, j, k ) ];
+				
+				c.offset = config->GetValue( Form( "febex_%d_%d_%d.Offset", i, j, k ), 0. );
+				c.gain = config->GetValue( Form( "febex_%d_%d_%d.Gain", i, j, k ), 1. );
+				c.gain_quadr = config->GetValue( Form( "febex_%d_%d_%d.GainQuadr", i, j, k ), 0. );
+				c.threshold = config->GetValue( Form( "febex_%d_%d_%d.Threshold", i, j, k ), 0. );
+				c.time = config->GetValue( Form( "febex_%d_%d_%d.Time", i, j, k ), 0 );
+				c.mwd_decay = config->GetValue( Form( "febex_%d_%d_%d.MWD.DecayTime", i, j, k ), default_MWD_Decay );
+				c.mwd_rise = config->GetValue( Form( "febex_%d_%d_%d.MWD.RiseTime", i, j, k ), (int)default_MWD_Rise );
+				c.mwd_top = config->GetValue( Form( "febex_%d_%d_%d.MWD.FlatTop", i, j, k ), (int)default_MWD_Top );
+				c.mwd_window = config->GetValue( Form( "febex_%d_%d_%d.MWD.Window", i, j, k ), (int)default_MWD_Window );
+				c.cfd_delay = config->GetValue( Form( "febex_%d_%d_%d.CFD.DelayTime", i, j, k ), (int)default_CFD_Delay );
+				c.cfd_threshold = config->GetValue( Form( "febex_%d_%d_%d.CFD.Threshold", i, j, k ), (int)default_CFD_Threshold );
+				c.cfd_fraction = config->GetValue( Form( "febex_%d_%d_%d.CFD.Fraction", i, j, k ), default_CFD_Fraction );
+				
+				// Check if we have defaults
+				c.is_default = TMath::Abs( c.gain_quadr ) < 1e-6 &&
+							   TMath::Abs( c.gain - 1.0 ) < 1e-6 &&
+							   TMath::Abs( c.offset ) < 1e-6;
 
 			} // k: channel
 			
 		} // j: board
 		
 	} // i: sfp
+	
+	// Keep it all for next time
+	ConfigCache new_cache( fInputFile, key );
+	CacheCalibration( new_cache );
+	new_cache.Save();
 
 }
 
+// Pack everything read from the file in to the cache, or unpack it again.
+// Anything added to the calibration, or a change to the defaults, needs a
+// new class version so that old caches aren't used.
+void Calibration::CacheCalibration( ConfigCache &cache ) {
+	
+	cache.Data( default_MWD_Decay );
+	cache.Data( default_MWD_Rise );
+	cache.Data( default_MWD_Top );
+	cache.Data( default_MWD_Window );
+	cache.Data( default_CFD_Delay );
+	cache.Data( default_CFD_Threshold );
+	cache.Data( default_CFD_Fraction );
+	cache.Data( fFebexCal );
+	
+	return;
+	
+}
+
 float Calibration::FebexEnergy( unsigned int sfp, unsigned int board, unsigned int ch, unsigned short raw ) {
 	
-	float energy, raw_rand;
-	TRandom *fRand = new TRandom();
+	if( IsFebexChannel( sfp, board, ch ) )
+		return FebexEnergy( fFebexCal[ GetFebexIndex( sfp, board, ch ) ], raw );
 	
-	if(   sfp < set->GetNumberOfFebexSfps() &&
-	    board < set->GetNumberOfFebexBoards() &&
-	       ch < set->GetNumberOfFebexChannels() ) {
+	return -1;
+	
+}
 
-		raw_rand = raw + 0.5 - fRand->Uniform();
+// Same again, for a channel that was already looked up in the table
+float Calibration::FebexEnergy( const FebexChannelCal &c, unsigned short raw ) {
+	
+	if( c.is_default ) return raw;
+	
+	float raw_rand = raw + 0.5 - Dither();
+	
+	float energy  = c.gain_quadr * raw_rand;
+	energy += c.gain;
+	energy *= raw_rand;
+	energy += c.offset;
 
-		energy  = fFebexGainQuadr[sfp][board][ch] * raw_rand * raw_rand;
-		energy += fFebexGain[sfp][board][ch] * raw_rand;
-		energy += fFebexOffset[sfp][board][ch];
+	return energy;
+	
+}
 
-		// Check if we have defaults
-		if( TMath::Abs( fFebexGainQuadr[sfp][board][ch] ) < 1e-6 &&
-		    TMath::Abs( fFebexGain[sfp][board][ch] - 1.0 ) < 1e-6 &&
-		    TMath::Abs( fFebexOffset[sfp][board][ch] ) < 1e-6 )
-			
-			return raw;
-		
-		else return energy;
-		
-	}
+// Uniform random number in [0,1) to spread the raw values over the bin.
+// Each thread has its own generator, seeded one after the other so
+// that a run with one thread always gives the same answer.
+float Calibration::Dither() {
 	
-	delete fRand;
+	static std::atomic<unsigned long long> next_seed( 0 );
+	thread_local DitherRandom rng( next_seed++ );
 	
-	return -1;
+	return rng.Uniform();
 	
 }
 
-FebexMWD Calibration::DoMWD( unsigned int sfp, unsigned int board, unsigned int ch, std::vector<unsigned short> trace) {
+FebexMWD Calibration::DoMWD( unsigned int sfp, unsigned int board, unsigned int ch, const std::vector<unsigned short> &trace) {
 	std::string trace_name = "";
 	return DoMWD( sfp, board, ch, trace, trace_name );
 }
 
 
-FebexMWD Calibration::DoMWD( unsigned int sfp, unsigned int board, unsigned int ch, std::vector<unsigned short> trace, std::string trace_name ) {
+FebexMWD Calibration::DoMWD( unsigned int sfp, unsigned int board, unsigned int ch, const std::vector<unsigned short> &trace, std::string trace_name ) {
 	
 	// Create a FebexMWD class to hold the info
 	FebexMWD mwd;
+	DoMWD( sfp, board, ch, trace, mwd, trace_name );
+
+	return mwd;
+	
+}
+
+
+void Calibration::DoMWD( unsigned int sfp, unsigned int board, unsigned int ch, const std::vector<unsigned short> &trace, FebexMWD &mwd, std::string trace_name ) {
 	
 	// Check if it's a valid event first
-	if(   sfp < set->GetNumberOfFebexSfps() &&
-	    board < set->GetNumberOfFebexBoards() &&
-	       ch < set->GetNumberOfFebexChannels() ) {
+	if( IsFebexChannel( sfp, board, ch ) ) {
 
 		// Set the parameters of the MWD
+		const FebexChannelCal &c = fFebexCal[ GetFebexIndex( sfp, board, ch ) ];
 		mwd.SetTrace( trace );
-		mwd.SetRiseTime( fFebexMWD_Rise[sfp][board][ch] );
-		mwd.SetDecayTime( fFebexMWD_Decay[sfp][board][ch] );
-		mwd.SetFlatTop( fFebexMWD_Top[sfp][board][ch] );
-		mwd.SetWindow( fFebexMWD_Window[sfp][board][ch] );
-		mwd.SetDelayTime( fFebexCFD_Delay[sfp][board][ch] );
-		mwd.SetThreshold( fFebexCFD_Threshold[sfp][board][ch] );
-		mwd.SetFraction( fFebexCFD_Fraction[sfp][board][ch] );
+		mwd.SetRiseTime( c.mwd_rise );
+		mwd.SetDecayTime( c.mwd_decay );
+		mwd.SetFlatTop( c.mwd_top );
+		mwd.SetWindow( c.mwd_window );
+		mwd.SetDelayTime( c.cfd_delay );
+		mwd.SetThreshold( c.cfd_threshold );
+		mwd.SetFraction( c.cfd_fraction );
 
 		// Run the MWD
 		mwd.DoMWD(trace_name);
 		
 	}
+	
+	// Nothing from the last trace
+	else mwd.Clear();
 
-	return mwd;
+	return;
 	
 }
 
 
-float Calibration::FebexThreshold( unsigned int sfp, unsigned int board, unsigned int ch ) {
+void Calibration::DoMWD( unsigned int sfp, unsigned int board, unsigned int ch, FebexMWDBatch &batch ) {
 	
-	if(   sfp < set->GetNumberOfFebexSfps() &&
-	    board < set->GetNumberOfFebexBoards() &&
-	       ch < set->GetNumberOfFebexChannels() ) {
+	// Check if it's a valid channel first
+	if( IsFebexChannel( sfp, board, ch ) ) {
+
+		// Set the parameters of the MWD
+		const FebexChannelCal &c = fFebexCal[ GetFebexIndex( sfp, board, ch ) ];
+		batch.SetRiseTime( c.mwd_rise );
+		batch.SetDecayTime( c.mwd_decay );
+		batch.SetFlatTop( c.mwd_top );
+		batch.SetWindow( c.mwd_window );
+		batch.SetDelayTime( c.cfd_delay );
+		batch.SetThreshold( c.cfd_threshold );
+		batch.SetFraction( c.cfd_fraction );
 
-		return fFebexThreshold[sfp][board][ch];
+		// Run the MWD
+		batch.DoMWD();
 		
 	}
+
+	return;
+	
+}
+
+
+float Calibration::FebexThreshold( unsigned int sfp, unsigned int board, unsigned int ch ) {
+	
+	if( IsFebexChannel( sfp, board, ch ) )
+		return fFebexCal[ GetFebexIndex( sfp, board, ch ) ].threshold;
 	
 	return -1;
 	
@@ -307,13 +593,8 @@ float Calibration::FebexThreshold( unsigned int sfp, unsigned int board, unsigne
 
 long Calibration::FebexTime( unsigned int sfp, unsigned int board, unsigned int ch ){
 	
-	if(   sfp < set->GetNumberOfFebexSfps() &&
-	    board < set->GetNumberOfFebexBoards() &&
-	       ch < set->GetNumberOfFebexChannels() ) {
-
-		return fFebexTime[sfp][board][ch];
-		
-	}
+	if( IsFebexChannel( sfp, board, ch ) )
+		return fFebexCal[ GetFebexIndex( sfp, board, ch ) ].time;
 	
 	return 0;
 	
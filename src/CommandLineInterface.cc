@@ -114,7 +114,7 @@ bool CommandLineInterface::CheckFlags( unsigned int argc, char* argv[], const bo
 				
 				else if(fTypes[j] == "long long") {
 					
-					*((long long*) fValues[j]) = atoi(argv[i+1]);
+					*((long long*) fValues[j]) = atoll(argv[i+1]);
 					i++;
 					break;//found the right flag for this argument so the flag loop can be stopped
 					
@@ -200,7 +200,7 @@ bool CommandLineInterface::CheckFlags( unsigned int argc, char* argv[], const bo
 					while( i < argc ) {
 						
 						if(argv[i][0] != '-') {
-							(*((vector<long long>*)fValues[j])).push_back(atoi(argv[i]));
+							(*((vector<long long>*)fValues[j])).push_back(atoll(argv[i]));
 							i++;
 						}
 						
@@ -0,0 +1,400 @@
+#include "CompressedFile.hh"
+
+#include <cstring>
+
+#include <zlib.h>
+
+#ifdef HAVE_ZSTD
+# include <zstd.h>
+#endif
+
+#ifdef HAVE_LZ4
+# include <lz4frame.h>
+#endif
+
+CompressedFile::CompressedFile(){
+
+	input_file = nullptr;
+	format = FORMAT_NONE;
+	chunk_pos = 0;
+	flag_done = true;
+	flag_stop = false;
+
+}
+
+CompressedFile::~CompressedFile(){
+
+	Close();
+
+}
+
+// Work out the format from the magic number at the start of the file
+CompressedFile::format_t CompressedFile::GetFormat( std::string input_file_name ){
+
+	FILE *fp = fopen( input_file_name.data(), "rb" );
+	if( !fp ) return FORMAT_NONE;
+
+	unsigned char magic[4] = { 0, 0, 0, 0 };
+	size_t n = fread( magic, 1, 4, fp );
+	fclose( fp );
+
+	if( n >= 2 && magic[0] == 0x1F && magic[1] == 0x8B )
+		return FORMAT_GZIP;
+
+	if( n == 4 && magic[0] == 0x28 && magic[1] == 0xB5 &&
+	    magic[2] == 0x2F && magic[3] == 0xFD )
+		return FORMAT_ZSTD;
+
+	if( n == 4 && magic[0] == 0x04 && magic[1] == 0x22 &&
+	    magic[2] == 0x4D && magic[3] == 0x18 )
+		return FORMAT_LZ4;
+
+	return FORMAT_NONE;
+
+}
+
+// Check if we were compiled with the library for this format
+bool CompressedFile::IsSupported( format_t fmt ){
+
+	if( fmt == FORMAT_GZIP ) return true;
+
+#ifdef HAVE_ZSTD
+	if( fmt == FORMAT_ZSTD ) return true;
+#endif
+
+#ifdef HAVE_LZ4
+	if( fmt == FORMAT_LZ4 ) return true;
+#endif
+
+	return false;
+
+}
+
+std::string CompressedFile::GetFormatName( format_t fmt ){
+
+	if( fmt == FORMAT_GZIP ) return "gzip";
+	if( fmt == FORMAT_ZSTD ) return "zstd";
+	if( fmt == FORMAT_LZ4 ) return "lz4";
+	return "uncompressed";
+
+}
+
+bool CompressedFile::Open( std::string input_file_name ){
+
+	Close();
+
+	format = GetFormat( input_file_name );
+	if( format == FORMAT_NONE ) return false;
+
+	if( !IsSupported( format ) ) {
+
+		std::cout << input_file_name << " is compressed with " << GetFormatName( format );
+		std::cout << ", but MiniballSort was compiled without it" << std::endl;
+		return false;
+
+	}
+
+	input_file = fopen( input_file_name.data(), "rb" );
+	if( !input_file ) return false;
+	file_name = input_file_name;
+
+	// Start uncompressing straight away
+	chunk_pos = 0;
+	flag_done = false;
+	flag_stop = false;
+	worker = std::thread( &CompressedFile::Decompress, this );
+
+	return true;
+
+}
+
+void CompressedFile::Close(){
+
+	// Tell the thread to stop, even if the reader didn't get to the end
+	if( worker.joinable() ) {
+
+		{
+			std::lock_guard<std::mutex> lk( chunk_lock );
+			flag_stop = true;
+		}
+		chunk_taken.notify_all();
+		worker.join();
+
+	}
+
+	if( input_file ) fclose( input_file );
+	input_file = nullptr;
+	chunks.clear();
+	chunk_pos = 0;
+	flag_done = true;
+
+	return;
+
+}
+
+// Copy the next length bytes in to data, waiting for the thread if we
+// have to. It is only short at the end of the file. With data == nullptr,
+// the bytes are just skipped.
+unsigned long long CompressedFile::Read( char *data, unsigned long long length ){
+
+	unsigned long long n = 0;
+	std::unique_lock<std::mutex> lk( chunk_lock );
+
+	while( n < length ) {
+
+		chunk_ready.wait( lk, [this]{ return !chunks.empty() || flag_done; } );
+		if( chunks.empty() ) break;
+
+		// The thread only adds to the back, so the front chunk
+		// can be copied without holding the lock
+		std::vector<char> &front = chunks.front();
+		unsigned long long m = std::min( length - n, (unsigned long long)front.size() - chunk_pos );
+
+		lk.unlock();
+		if( data ) std::memcpy( data + n, front.data() + chunk_pos, m );
+		lk.lock();
+
+		n += m;
+		chunk_pos += m;
+		if( chunk_pos == front.size() ) {
+
+			chunks.pop_front();
+			chunk_pos = 0;
+			chunk_taken.notify_one();
+
+		}
+
+	}
+
+	return n;
+
+}
+
+unsigned long long CompressedFile::Ignore( unsigned long long length ){
+
+	return Read( nullptr, length );
+
+}
+
+bool CompressedFile::PushChunk( std::vector<char> &chunk ){
+
+	std::unique_lock<std::mutex> lk( chunk_lock );
+	chunk_taken.wait( lk, [this]{ return chunks.size() < max_chunks || flag_stop; } );
+	if( flag_stop ) return false;
+
+	if( chunk.size() ) {
+
+		chunks.push_back( std::move( chunk ) );
+		chunk_ready.notify_one();
+
+	}
+
+	chunk.assign( chunk_size, 0 );
+
+	return true;
+
+}
+
+// Thread that uncompresses the whole file in to chunks
+void CompressedFile::Decompress(){
+
+	bool flag_ok = false;
+	if( format == FORMAT_GZIP ) flag_ok = DecompressGzip();
+	else if( format == FORMAT_ZSTD ) flag_ok = DecompressZstd();
+	else if( format == FORMAT_LZ4 ) flag_ok = DecompressLz4();
+
+	if( !flag_ok && !flag_stop )
+		std::cout << "Error uncompressing " << file_name << ", it stops here" << std::endl;
+
+	{
+		std::lock_guard<std::mutex> lk( chunk_lock );
+		flag_done = true;
+	}
+	chunk_ready.notify_all();
+
+	return;
+
+}
+
+// A truncated file, i.e. one still being written, is not an error.
+// We get as much as we can and the rest is picked up next time.
+bool CompressedFile::DecompressGzip(){
+
+	z_stream strm;
+	std::memset( &strm, 0, sizeof(strm) );
+
+	// Accept gzip or zlib headers
+	if( inflateInit2( &strm, 15 + 32 ) != Z_OK ) return false;
+
+	std::vector<char> in( chunk_size ), out( chunk_size );
+	strm.next_out = (Bytef*)out.data();
+	strm.avail_out = out.size();
+
+	bool flag_ok = true;
+	bool flag_full = false;
+	while( true ) {
+
+		// Only read more when everything so far has come out
+		if( strm.avail_in == 0 && !flag_full ) {
+
+			size_t n = fread( in.data(), 1, in.size(), input_file );
+			if( n == 0 ) break;
+			strm.next_in = (Bytef*)in.data();
+			strm.avail_in = n;
+
+		}
+
+		int ret = inflate( &strm, Z_NO_FLUSH );
+
+		// There can be more than one gzip member in a file
+		if( ret == Z_STREAM_END ) inflateReset( &strm );
+
+		else if( ret != Z_OK && ret != Z_BUF_ERROR ) {
+
+			flag_ok = false;
+			break;
+
+		}
+
+		flag_full = strm.avail_out == 0;
+		if( flag_full ) {
+
+			if( !PushChunk( out ) ) break;
+			strm.next_out = (Bytef*)out.data();
+			strm.avail_out = out.size();
+
+		}
+
+	}
+
+	// Whatever is left
+	out.resize( out.size() - strm.avail_out );
+	PushChunk( out );
+	inflateEnd( &strm );
+
+	return flag_ok;
+
+}
+
+bool CompressedFile::DecompressZstd(){
+
+#ifdef HAVE_ZSTD
+
+	ZSTD_DStream *dstream = ZSTD_createDStream();
+	if( !dstream ) return false;
+	ZSTD_initDStream( dstream );
+
+	std::vector<char> in( ZSTD_DStreamInSize() ), out( chunk_size );
+	ZSTD_inBuffer input = { in.data(), 0, 0 };
+	ZSTD_outBuffer output = { out.data(), out.size(), 0 };
+
+	bool flag_ok = true;
+	bool flag_full = false;
+	while( true ) {
+
+		// Only read more when everything so far has come out
+		if( input.pos == input.size && !flag_full ) {
+
+			size_t n = fread( in.data(), 1, in.size(), input_file );
+			if( n == 0 ) break;
+			input.size = n;
+			input.pos = 0;
+
+		}
+
+		size_t ret = ZSTD_decompressStream( dstream, &output, &input );
+		if( ZSTD_isError( ret ) ) {
+
+			flag_ok = false;
+			break;
+
+		}
+
+		flag_full = output.pos == output.size;
+		if( flag_full ) {
+
+			if( !PushChunk( out ) ) break;
+			output.dst = out.data();
+			output.pos = 0;
+
+		}
+
+	}
+
+	// Whatever is left
+	out.resize( output.pos );
+	PushChunk( out );
+	ZSTD_freeDStream( dstream );
+
+	return flag_ok;
+
+#else
+
+	return false;
+
+#endif
+
+}
+
+bool CompressedFile::DecompressLz4(){
+
+#ifdef HAVE_LZ4
+
+	LZ4F_dctx *dctx;
+	if( LZ4F_isError( LZ4F_createDecompressionContext( &dctx, LZ4F_VERSION ) ) )
+		return false;
+
+	std::vector<char> in( chunk_size ), out( chunk_size );
+	size_t in_pos = 0, in_size = 0, out_pos = 0;
+
+	bool flag_ok = true;
+	bool flag_full = false;
+	while( true ) {
+
+		// Only read more when everything so far has come out
+		if( in_pos == in_size && !flag_full ) {
+
+			in_size = fread( in.data(), 1, in.size(), input_file );
+			in_pos = 0;
+			if( in_size == 0 ) break;
+
+		}
+
+		size_t src = in_size - in_pos;
+		size_t dst = out.size() - out_pos;
+		size_t ret = LZ4F_decompress( dctx, out.data() + out_pos, &dst,
+									 in.data() + in_pos, &src, nullptr );
+		if( LZ4F_isError( ret ) ) {
+
+			flag_ok = false;
+			break;
+
+		}
+
+		in_pos += src;
+		out_pos += dst;
+
+		flag_full = out_pos == out.size();
+		if( flag_full ) {
+
+			if( !PushChunk( out ) ) break;
+			out_pos = 0;
+
+		}
+
+	}
+
+	// Whatever is left
+	out.resize( out_pos );
+	PushChunk( out );
+	LZ4F_freeDecompressionContext( dctx );
+
+	return flag_ok;
+
+#else
+
+	return false;
+
+#endif
+
+}
@@ -0,0 +1,113 @@
+#include "ConfigCache.hh"
+
+#include <cstdio>
+#include <fstream>
+#include <iterator>
+
+#include <unistd.h>
+
+// Sidecar file format, change the version if the layout changes
+static const char cache_magic[] = "MBCFG001";
+
+ConfigCache::ConfigCache( std::string input_file_name, unsigned long long cache_key ) {
+
+	input_file = input_file_name;
+	cache_file = GetCacheFileName( input_file_name );
+	key = cache_key;
+	hash = 0;
+	pos = 0;
+	flag_read = false;
+	flag_good = true;
+	flag_hash = HashFile();
+
+}
+
+// 64-bit FNV-1a hash of the whole text file
+bool ConfigCache::HashFile(){
+
+	std::ifstream in( input_file, std::ios::in|std::ios::binary );
+	if( !in.is_open() ) return false;
+
+	std::string contents( ( std::istreambuf_iterator<char>( in ) ),
+						 std::istreambuf_iterator<char>() );
+
+	hash = 0xCBF29CE484222325ULL;
+	for( unsigned long long i = 0; i < contents.size(); ++i ) {
+
+		hash ^= (unsigned char)contents[i];
+		hash *= 0x100000001B3ULL;
+
+	}
+
+	return true;
+
+}
+
+// Read the cache if it was made from the same text file with the same key.
+// Returns false if there isn't one, and the Data() calls make a new one.
+bool ConfigCache::Load(){
+
+	flag_read = false;
+	flag_good = true;
+	buffer.clear();
+	pos = 0;
+
+	if( !flag_hash ) return false;
+
+	std::ifstream in( cache_file, std::ios::in|std::ios::binary );
+	if( !in.is_open() ) return false;
+
+	char magic[8];
+	unsigned long long file_key, file_hash, size;
+	in.read( magic, 8 );
+	in.read( (char*)&file_key, sizeof(file_key) );
+	in.read( (char*)&file_hash, sizeof(file_hash) );
+	in.read( (char*)&size, sizeof(size) );
+	if( !in.good() || std::string( magic, 8 ) != cache_magic ||
+	    file_key != key || file_hash != hash ) return false;
+
+	// Everything else in one go
+	buffer.resize( size );
+	in.read( buffer.data(), size );
+	if( !in.good() ) {
+
+		buffer.clear();
+		return false;
+
+	}
+
+	flag_read = true;
+
+	return true;
+
+}
+
+// Write what was packed. It goes to a temporary file first, so that
+// another job reading the same settings never sees half a cache.
+// If we cannot write next to the text file, we just carry on without it.
+bool ConfigCache::Save(){
+
+	if( !flag_hash || flag_read ) return false;
+
+	std::string tmp_file = cache_file + "." + std::to_string( getpid() );
+	std::ofstream out( tmp_file, std::ios::out|std::ios::binary|std::ios::trunc );
+	if( !out.is_open() ) return false;
+
+	unsigned long long size = buffer.size();
+	out.write( cache_magic, 8 );
+	out.write( (char*)&key, sizeof(key) );
+	out.write( (char*)&hash, sizeof(hash) );
+	out.write( (char*)&size, sizeof(size) );
+	out.write( buffer.data(), size );
+	out.close();
+
+	if( out.fail() || std::rename( tmp_file.data(), cache_file.data() ) != 0 ) {
+
+		std::remove( tmp_file.data() );
+		return false;
+
+	}
+
+	return true;
+
+}
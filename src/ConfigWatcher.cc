@@ -0,0 +1,181 @@
+#include "ConfigWatcher.hh"
+
+#include <chrono>
+
+#include <poll.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#ifdef LINUX
+# include <sys/inotify.h>
+#endif
+
+ConfigWatcher::ConfigWatcher(){
+
+	fd = -1;
+	flag_stop = false;
+
+}
+
+ConfigWatcher::~ConfigWatcher(){
+
+	Stop();
+
+}
+
+bool ConfigWatcher::GetFileState( std::string file_name, FileState &state ){
+
+	struct stat file_stat;
+	if( stat( file_name.data(), &file_stat ) != 0 ) return false;
+
+#ifdef LINUX
+	state.mtime = (long long)file_stat.st_mtim.tv_sec * 1000000000LL + file_stat.st_mtim.tv_nsec;
+#else
+	state.mtime = (long long)file_stat.st_mtime * 1000000000LL;
+#endif
+	state.size = file_stat.st_size;
+	state.inode = file_stat.st_ino;
+
+	return true;
+
+}
+
+bool ConfigWatcher::Watch( std::string file_name, std::function<void()> callback ){
+
+	// Files can only be added before we start
+	if( worker.joinable() ) return false;
+
+	FileState state = { 0, 0, 0 };
+	if( !GetFileState( file_name, state ) ) {
+
+		std::cerr << "Cannot watch " << file_name << ", it does not exist" << std::endl;
+		return false;
+
+	}
+
+	files.push_back( file_name );
+	callbacks.push_back( callback );
+	last_state.push_back( state );
+	new_state.push_back( state );
+	flag_changed.push_back( false );
+
+	return true;
+
+}
+
+bool ConfigWatcher::Start(){
+
+	if( worker.joinable() || files.empty() ) return false;
+
+#ifdef LINUX
+	// Watch the directory of each file, a second watch
+	// on the same directory is just the same one again
+	fd = inotify_init1( IN_NONBLOCK | IN_CLOEXEC );
+	for( unsigned int i = 0; i < files.size() && fd >= 0; ++i ) {
+
+		std::string dir_name = ".";
+		if( files[i].find_last_of("/") != std::string::npos )
+			dir_name = files[i].substr( 0, files[i].find_last_of("/") + 1 );
+
+		if( inotify_add_watch( fd, dir_name.data(), IN_CLOSE_WRITE | IN_MOVED_TO |
+							  IN_CREATE | IN_ATTRIB ) < 0 ) {
+
+			close( fd );
+			fd = -1;
+
+		}
+
+	}
+
+	if( fd < 0 ) std::cerr << "No inotify, looking for changes every second" << std::endl;
+#endif
+
+	flag_stop = false;
+	worker = std::thread( &ConfigWatcher::WatchFiles, this );
+
+	return true;
+
+}
+
+void ConfigWatcher::Stop(){
+
+	if( worker.joinable() ) {
+
+		flag_stop = true;
+		worker.join();
+
+	}
+
+	if( fd >= 0 ) close( fd );
+	fd = -1;
+
+	return;
+
+}
+
+void ConfigWatcher::WatchFiles(){
+
+	// Without inotify we look at the files every fourth tick
+	const int tick_ms = 250;
+	unsigned long long ntick = 0;
+
+	while( !flag_stop ) {
+
+		bool flag_look = false;
+		bool flag_settling = false;
+		for( unsigned int i = 0; i < flag_changed.size(); ++i )
+			if( flag_changed[i] ) flag_settling = true;
+
+		// Wait for something to happen in the directories, but wake up
+		// regularly to see if we should stop or if a change has settled
+		if( fd >= 0 ) {
+
+			struct pollfd pfd = { fd, POLLIN, 0 };
+			if( poll( &pfd, 1, tick_ms ) > 0 ) {
+
+				// We only need to know that something happened
+				char events[4096];
+				while( read( fd, events, sizeof(events) ) > 0 );
+				flag_look = true;
+
+			}
+
+		}
+
+		else {
+
+			std::this_thread::sleep_for( std::chrono::milliseconds( tick_ms ) );
+			if( ++ntick % 4 == 0 ) flag_look = true;
+
+		}
+
+		if( !flag_look && !flag_settling ) continue;
+
+		// A file has settled if it didn't change since the last tick,
+		// so we don't read it again while it is still being written
+		for( unsigned int i = 0; i < files.size(); ++i ) {
+
+			FileState state;
+			if( !GetFileState( files[i], state ) ) continue;
+
+			if( state != new_state[i] ) {
+
+				new_state[i] = state;
+				flag_changed[i] = state != last_state[i];
+
+			}
+
+			else if( flag_changed[i] ) {
+
+				last_state[i] = state;
+				flag_changed[i] = false;
+				callbacks[i]();
+
+			}
+
+		}
+
+	}
+
+	return;
+
+}
@@ -1,5 +1,10 @@
 #include "Converter.hh"
 
+#if defined(__x86_64__) || defined(__i386__)
+# include <immintrin.h>
+# define CONVERTER_SIMD_X86
+#endif
+
 Converter::Converter( std::shared_ptr<Settings> myset ) {
 
 	// We need to do initialise, but only after Settings are added
@@ -7,6 +12,8 @@ Converter::Converter( std::shared_ptr<Settings> myset ) {
 
 	my_tm_stp_msb = 0;
 	my_tm_stp_hsb = 0;
+	my_adc_data_lsb = 0;
+	my_adc_data_hsb = 0;
 
 	ctr_febex_hit.resize( set->GetNumberOfFebexSfps() );
 	ctr_febex_pause.resize( set->GetNumberOfFebexSfps() );
@@ -31,15 +38,337 @@ Converter::Converter( std::shared_ptr<Settings> myset ) {
 	// Default that we do not have a source only run
 	flag_source = false;
 	
+	// A queue of hits for each board, plus one for anything else
+	sort_queue.resize( set->GetNumberOfFebexSfps() * set->GetNumberOfFebexBoards() + 1 );
+	sort_samples.resize( sort_queue.size() );
+	sort_febex = std::make_shared<FebexData>();
+	sort_info = std::make_shared<InfoData>();
+	sort_bytes = 0;
+	sort_chunk_hits = 0;
+	sort_chunk_count = 0;
+	reorder_seq = 0;
+	reorder_newest = 0;
+	reorder_last = 0;
+	ctr_reorder_fill = 0;
+	ctr_reorder_late = 0;
+	flag_reset_sorted = false;
+	sample_tree = nullptr;
+	
+	// No checkpoints unless asked for in SetOutput
+	resume_block = 0;
+	flag_resume = false;
+	
 	// No progress bar by default
 	_prog_ = false;
+	job_percent = 0;
+
+	// Block size from the settings, 0 means we look at the data
+	flag_auto_block_size = set->GetBlockSize() == 0;
+	if( flag_auto_block_size ) SetBlockSize( 0x10000 );
+	else SetBlockSize( set->GetBlockSize() );
+	
+	// Blocks are copied into our own arrays until we map a file
+	block_header = block_header_buf;
+	block_data = block_data_buf.data();
+	map_data = nullptr;
+	map_size = 0;
+	
+	// Decode in a single thread by default
+	nthreads = 1;
+	decode_generation = 0;
+	decode_nbatch = 0;
+	decode_next = 0;
+	decode_nbusy = 0;
+	decode_stop = false;
+	
+	// Fastest way to swap the blocks and unpack traces on this CPU
+	SelectKernels();
+	
+	// No block index until we read or make one
+	flag_index_only = false;
+	flag_write_index = false;
+	idx_tm_stp_msb = 0;
+	idx_tm_stp_hsb = 0;
+	
+	// No FEBEX data items yet
+	flag_febex_data0 = false;
+	flag_febex_data1 = false;
+	flag_febex_data2 = false;
+	flag_febex_data3 = false;
+	flag_febex_trace = false;
+	my_time_offset = 0;
+
+}
 
+Converter::~Converter(){
+	
+	StopDecodeThreads();
+	
 }
 
-void Converter::SetOutput( std::string output_file_name ){
+void Converter::SetOutput( std::string output_file_name, bool flag_checkpoint ){
 	
 	// Open output file
 	output_file = new TFile( output_file_name.data(), "recreate", "FEBEX raw data file", 0 );
+	SetSortDir( output_file_name );
+	
+	// Any old checkpoint is from a conversion that we are starting again
+	checkpoint_file.clear();
+	flag_resume = false;
+	if( flag_checkpoint ) {
+		
+		checkpoint_file = output_file_name + ".ckpt";
+		RemoveCheckpoint();
+		
+	}
+
+	return;
+
+};
+
+// Read whole numbers from the checkpoint. False if any of them are
+// missing or aren't numbers, so that a damaged checkpoint isn't used.
+static bool GetCheckpointNumbers( TEnv &ckpt, std::string name,
+								 std::vector<unsigned long long> &values, unsigned int n = 1 ){
+	
+	std::stringstream ss( ckpt.GetValue( name.data(), "" ) );
+	std::string str;
+	values.clear();
+	while( ss >> str ) {
+		
+		if( str.find_first_not_of( "0123456789" ) != std::string::npos ) return false;
+		
+		errno = 0;
+		values.push_back( std::strtoull( str.data(), nullptr, 10 ) );
+		if( errno != 0 ) return false;
+		
+	}
+	
+	return values.size() == n;
+	
+}
+
+// Open the output file of an interrupted conversion again, with the state
+// from its checkpoint. If there isn't a checkpoint, or it doesn't match
+// the output file or the settings, use SetOutput to start from scratch.
+bool Converter::ResumeOutput( std::string output_file_name ){
+	
+	checkpoint_file = output_file_name + ".ckpt";
+	flag_resume = false;
+	
+	TEnv ckpt;
+	if( ckpt.ReadFile( checkpoint_file.data(), kEnvLocal ) != 0 ) return false;
+	
+	// It has to be the same kind of conversion
+	if( ckpt.GetValue( "SortWindow", -1.0 ) != set->GetSortWindow() ||
+	    ckpt.GetValue( "FlatHitOutput", -1 ) != (int)set->IsFlatOutput() ||
+	    ckpt.GetValue( "FebexSfps", -1 ) != (int)set->GetNumberOfFebexSfps() ||
+	    ckpt.GetValue( "FebexBoards", -1 ) != (int)set->GetNumberOfFebexBoards() ) {
+		
+		std::cout << checkpoint_file << " was made with different settings" << std::endl;
+		return false;
+		
+	}
+	
+	// All of the sorted chunks must still be there
+	std::stringstream ss( ckpt.GetValue( "SortChunks", "" ) );
+	std::vector<std::string> chunks;
+	std::string name;
+	while( ss >> name ) {
+		
+		std::ifstream chunk( name );
+		if( !chunk.is_open() ) {
+			
+			std::cout << "Missing " << name << " from " << checkpoint_file << std::endl;
+			return false;
+			
+		}
+		chunks.push_back( name );
+		
+	}
+	
+	// Where we were and all of the counters
+	std::vector<unsigned long long> next_block, tm_stp_msb, tm_stp_hsb, febex_ext;
+	std::vector<unsigned long long> sorted_entries, chunk_hits;
+	std::vector<unsigned long long> seq, newest, last, filled, late;
+	bool flag_good = GetCheckpointNumbers( ckpt, "NextBlock", next_block ) &&
+		GetCheckpointNumbers( ckpt, "TimestampMSB", tm_stp_msb ) &&
+		GetCheckpointNumbers( ckpt, "TimestampHSB", tm_stp_hsb ) &&
+		GetCheckpointNumbers( ckpt, "FebexExtTrigger", febex_ext ) &&
+		GetCheckpointNumbers( ckpt, "SortedEntries", sorted_entries ) &&
+		GetCheckpointNumbers( ckpt, "SortChunkHits", chunk_hits ) &&
+		GetCheckpointNumbers( ckpt, "ReorderSeq", seq ) &&
+		GetCheckpointNumbers( ckpt, "ReorderNewest", newest ) &&
+		GetCheckpointNumbers( ckpt, "ReorderLast", last ) &&
+		GetCheckpointNumbers( ckpt, "ReorderFilled", filled ) &&
+		GetCheckpointNumbers( ckpt, "ReorderLate", late );
+	
+	unsigned int nsfp = set->GetNumberOfFebexSfps();
+	unsigned int nboard = set->GetNumberOfFebexBoards();
+	std::vector<std::vector<unsigned long long>> hit( nsfp ), pause( nsfp ), resume( nsfp );
+	for( unsigned int i = 0; i < nsfp && flag_good; ++i ) {
+		
+		flag_good = GetCheckpointNumbers( ckpt, "FebexHits." + std::to_string(i), hit[i], nboard ) &&
+			GetCheckpointNumbers( ckpt, "FebexPause." + std::to_string(i), pause[i], nboard ) &&
+			GetCheckpointNumbers( ckpt, "FebexResume." + std::to_string(i), resume[i], nboard );
+		
+	}
+	
+	// The hits that were waiting to be sorted, in the reorder buffer of
+	// the streaming sort or in the sort queues. The reorder buffer is read
+	// back in the same order, so it's still a heap.
+	std::vector<ReorderHit> buffer;
+	std::vector<std::vector<SortHit>> queue( sort_queue.size() );
+	std::vector<std::vector<unsigned short>> samples( sort_queue.size() );
+	unsigned long long bytes = 0;
+	
+	std::string hits_file = ckpt.GetValue( "WaitingHits", "" );
+	std::ifstream hits( hits_file, std::ios::in|std::ios::binary );
+	if( hits_file.size() && !hits.is_open() ) {
+		
+		std::cout << "Missing " << hits_file << " from " << checkpoint_file << std::endl;
+		return false;
+		
+	}
+	
+	while( flag_good && hits.is_open() && hits.peek() != EOF ) {
+		
+		if( set->GetSortWindow() > 0 ) {
+			
+			ReorderHit rhit;
+			hits.read( (char*)&rhit.seq, sizeof(rhit.seq) );
+			hits.read( (char*)&rhit.hit, sizeof(SortHit) );
+			if( !hits.good() ) flag_good = false;
+			
+			else {
+				
+				rhit.samples.resize( rhit.hit.trace_length );
+				hits.read( (char*)rhit.samples.data(), rhit.hit.trace_length * sizeof(unsigned short) );
+				buffer.push_back( std::move( rhit ) );
+				flag_good = hits.good();
+				
+			}
+			
+		}
+		
+		else {
+			
+			unsigned int q;
+			SortHit qhit;
+			hits.read( (char*)&q, sizeof(q) );
+			hits.read( (char*)&qhit, sizeof(SortHit) );
+			if( !hits.good() || q >= queue.size() ) flag_good = false;
+			
+			else {
+				
+				qhit.trace_start = samples[q].size();
+				samples[q].resize( qhit.trace_start + qhit.trace_length );
+				hits.read( (char*)( samples[q].data() + qhit.trace_start ),
+						  qhit.trace_length * sizeof(unsigned short) );
+				queue[q].push_back( qhit );
+				bytes += sizeof(SortHit) + qhit.trace_length * sizeof(unsigned short);
+				flag_good = hits.good();
+				
+			}
+			
+		}
+		
+	}
+	
+	if( !flag_good ) {
+		
+		std::cout << checkpoint_file << " is damaged" << std::endl;
+		return false;
+		
+	}
+	
+	// The output file must be as it was at the checkpoint, i.e. the same
+	// number of entries in the tree and hits in the hit ID profiles
+	output_file = new TFile( output_file_name.data(), "update" );
+	bool flag_match = !output_file->IsZombie();
+	
+	TTree *t = nullptr;
+	if( flag_match )
+		t = (TTree*)output_file->Get( set->IsFlatOutput() ? "mb_hits" : "mb_sort" );
+	if( !t || (unsigned long long)t->GetEntries() != sorted_entries[0] )
+		flag_match = false;
+	
+	for( unsigned int i = 0; i < nsfp && flag_match; ++i ) {
+		
+		for( unsigned int j = 0; j < nboard; ++j ) {
+			
+			std::string hname = "sfp_" + std::to_string(i) + "/board_" + std::to_string(j);
+			hname += "/hfebex_hit_" + std::to_string(i) + "_" + std::to_string(j);
+			TProfile *p = (TProfile*)output_file->Get( hname.data() );
+			
+			if( !p || p->GetEntries() != hit[i][j] )
+				flag_match = false;
+			
+		}
+		
+	}
+	
+	if( !flag_match ) {
+		
+		std::cout << output_file_name << " doesn't match " << checkpoint_file << std::endl;
+		output_file->Close();
+		delete output_file;
+		output_file = nullptr;
+		return false;
+		
+	}
+	
+	// Now carry on as we were
+	SetSortDir( output_file_name );
+	resume_input_file = ckpt.GetValue( "InputFile", "" );
+	resume_block = next_block[0];
+	my_tm_stp_msb = tm_stp_msb[0];
+	my_tm_stp_hsb = tm_stp_hsb[0];
+	ctr_febex_ext = febex_ext[0];
+	
+	for( unsigned int i = 0; i < nsfp; ++i ) {
+		
+		for( unsigned int j = 0; j < nboard; ++j ) {
+			
+			ctr_febex_hit[i][j] = hit[i][j];
+			ctr_febex_pause[i][j] = pause[i][j];
+			ctr_febex_resume[i][j] = resume[i][j];
+			
+		}
+		
+	}
+	
+	sort_chunks = chunks;
+	sort_chunk_hits = chunk_hits[0];
+	sort_queue = std::move( queue );
+	sort_samples = std::move( samples );
+	sort_bytes = bytes;
+	
+	reorder_seq = seq[0];
+	reorder_newest = newest[0];
+	reorder_last = last[0];
+	ctr_reorder_fill = filled[0];
+	ctr_reorder_late = late[0];
+	reorder_buffer = std::move( buffer );
+	
+	std::cout << "Carrying on from " << checkpoint_file << " at block ";
+	std::cout << resume_block << " of " << resume_input_file << std::endl;
+	flag_resume = true;
+	
+	return true;
+	
+}
+
+// Hits that don't fit in memory while sorting go next to the output
+void Converter::SetSortDir( std::string output_file_name ){
+	
+	sort_dir = set->GetSortScratchDir();
+	if( sort_dir.empty() ) {
+		
+		if( output_file_name.find_last_of("/") == std::string::npos ) sort_dir = ".";
+		else sort_dir = output_file_name.substr( 0, output_file_name.find_last_of("/") );
+		
+	}
 
 	return;
 
@@ -51,18 +380,11 @@ void Converter::MakeTree() {
 	// Create Root tree
 	const int splitLevel = 2; // don't split branches = 0, full splitting = 99
 	const int bufsize = sizeof(FebexData) + sizeof(InfoData);
-	output_tree = new TTree( "mb", "mb" );
+	// There is no unsorted tree, hits are queued until SortTree is called
 	data_packet = std::make_unique<DataPackets>();
-	output_tree->Branch( "data", "DataPackets", data_packet.get(), bufsize, splitLevel );
-
-	sorted_tree = (TTree*)output_tree->CloneTree(0);
-	sorted_tree->SetName("mb_sort");
-	sorted_tree->SetTitle( "Time sorted, calibrated Miniball data" );
-	sorted_tree->SetDirectory( output_file->GetDirectory("/") );
-	output_tree->SetDirectory( output_file->GetDirectory("/") );
-	
-	output_tree->SetAutoFlush(-10e6);
-	sorted_tree->SetAutoFlush(-10e6);
+	sample_tree = nullptr;
+	flat_nsamples = 0;
+	flat_sample_pos = 0;
 
 	febex_data = std::make_shared<FebexData>();
 	info_data = std::make_shared<InfoData>();
@@ -70,14 +392,84 @@ void Converter::MakeTree() {
 	febex_data->ClearData();
 	info_data->ClearData();
 	
+	// The streaming sort carries on filling the trees from the checkpoint
+	if( flag_resume && set->GetSortWindow() > 0 && ResumeTrees() )
+		return;
+	
+	if( set->IsFlatOutput() ) {
+		
+		// Flat branches for each hit and the traces in a separate tree,
+		// as one long array of samples split in to fixed size entries
+		sorted_tree = new TTree( "mb_hits", "Time sorted, calibrated Miniball hits" );
+		flat_hit.MakeBranches( sorted_tree );
+		
+		std::string leaf = "samples[" + std::to_string( SortHit::samples_per_entry ) + "]/s";
+		sample_tree = new TTree( "mb_samples", "Trace samples for the hits in mb_hits" );
+		flat_samples.resize( SortHit::samples_per_entry );
+		sample_tree->Branch( "samples", flat_samples.data(), leaf.data() );
+		sample_tree->SetDirectory( output_file->GetDirectory("/") );
+		sample_tree->SetAutoFlush(-10e6);
+		
+	}
+	
+	else {
+		
+		sorted_tree = new TTree( "mb_sort", "Time sorted, calibrated Miniball data" );
+		sorted_tree->Branch( "data", "DataPackets", data_packet.get(), bufsize, splitLevel );
+		
+	}
+	sorted_tree->SetDirectory( output_file->GetDirectory("/") );
+	sorted_tree->SetAutoFlush(-10e6);
+	
+	// Only the checkpoints save the trees, so that what's in the
+	// file always matches the last checkpoint
+	if( !checkpoint_file.empty() ) {
+		
+		sorted_tree->SetAutoSave(0);
+		if( sample_tree ) sample_tree->SetAutoSave(0);
+		
+	}
+	
 	return;
 	
 }
 
+// Take the trees from the output file, as they were at the checkpoint
+bool Converter::ResumeTrees(){
+	
+	if( set->IsFlatOutput() ) {
+		
+		sorted_tree = (TTree*)output_file->Get( "mb_hits" );
+		sample_tree = (TTree*)output_file->Get( "mb_samples" );
+		if( !sorted_tree || !sample_tree ) return false;
+		
+		flat_hit.SetBranchAddresses( sorted_tree );
+		flat_samples.resize( SortHit::samples_per_entry );
+		sample_tree->SetBranchAddress( "samples", flat_samples.data() );
+		
+		// The samples were flushed at the checkpoint, so we start a new entry
+		flat_sample_pos = sample_tree->GetEntries() * SortHit::samples_per_entry;
+		
+	}
+	
+	else {
+		
+		sorted_tree = (TTree*)output_file->Get( "mb_sort" );
+		if( !sorted_tree ) return false;
+		
+		sorted_tree->SetBranchAddress( "data", data_packet.get() );
+		
+	}
+	
+	return true;
+	
+}
+
 void Converter::MakeHists() {
 	
 	std::string hname, htitle;
 	std::string dirname, maindirname, subdirname;
+	TDirectory *dir = output_file;
 	
 	// Make directories - just one DAQ type for now, no sub directories
 	// if you do add a directory here, please use a trailing slash
@@ -87,6 +479,9 @@ void Converter::MakeHists() {
 	hfebex.resize( set->GetNumberOfFebexSfps() );
 	hfebex_cal.resize( set->GetNumberOfFebexSfps() );
 	hfebex_mwd.resize( set->GetNumberOfFebexSfps() );
+	cnt_febex.resize( set->GetNumberOfFebexSfps() );
+	cnt_febex_cal.resize( set->GetNumberOfFebexSfps() );
+	cnt_febex_mwd.resize( set->GetNumberOfFebexSfps() );
 	hfebex_hit.resize( set->GetNumberOfFebexSfps() );
 	hfebex_pause.resize( set->GetNumberOfFebexSfps() );
 	hfebex_resume.resize( set->GetNumberOfFebexSfps() );
@@ -97,6 +492,9 @@ void Converter::MakeHists() {
 		hfebex[i].resize( set->GetNumberOfFebexBoards() );
 		hfebex_cal[i].resize( set->GetNumberOfFebexBoards() );
 		hfebex_mwd[i].resize( set->GetNumberOfFebexBoards() );
+		cnt_febex[i].resize( set->GetNumberOfFebexBoards() );
+		cnt_febex_cal[i].resize( set->GetNumberOfFebexBoards() );
+		cnt_febex_mwd[i].resize( set->GetNumberOfFebexBoards() );
 		hfebex_hit[i].resize( set->GetNumberOfFebexBoards() );
 		hfebex_pause[i].resize( set->GetNumberOfFebexBoards() );
 		hfebex_resume[i].resize( set->GetNumberOfFebexBoards() );
@@ -114,82 +512,19 @@ void Converter::MakeHists() {
 			if( !output_file->GetDirectory( dirname.data() ) )
 				output_file->mkdir( dirname.data() );
 			output_file->cd( dirname.data() );
+			dir = output_file->GetDirectory( dirname.data() );
 
-			// Loop over channels of each FEBEX board
+			// Spectra for each channel are only made when it has a hit
 			for( unsigned int k = 0; k < set->GetNumberOfFebexChannels(); ++k ) {
 				
-				// Uncalibrated energy
-				hname = "febex_" + std::to_string(i);
-				hname += "_" + std::to_string(j);
-				hname += "_" + std::to_string(k);
-				
-				htitle = "Raw FEBEX spectra for SFP " + std::to_string(i);
-				htitle += ", board " + std::to_string(j);
-				htitle += ", channel " + std::to_string(k);
-
-				htitle += ";Charge value;Counts";
-				
-				if( output_file->GetListOfKeys()->Contains( hname.data() ) )
-					hfebex[i][j][k] = (TH1F*)output_file->Get( hname.data() );
-				
-				else {
-					
-					hfebex[i][j][k] = new TH1F( hname.data(), htitle.data(),
-											65536, -0.5, 65535.5 );
-					
-					hfebex[i][j][k]->SetDirectory( output_file->GetDirectory( dirname.data() ) );
-					
-				}
-				
-				// Calibrated energy
-				hname = "febex_" + std::to_string(i);
-				hname += "_" + std::to_string(j);
-				hname += "_" + std::to_string(k);
-				hname += "_cal";
-				
-				htitle = "Calibrated FEBEX spectra for SFP " + std::to_string(i);
-				htitle += ", board " + std::to_string(j);
-				htitle += ", channel " + std::to_string(k);
-
-				htitle += ";Energy (keV);Counts per 0.5 keV";
-				
-				if( output_file->GetListOfKeys()->Contains( hname.data() ) )
-					hfebex_cal[i][j][k] = (TH1F*)output_file->Get( hname.data() );
-				
-				else {
-					
-					hfebex_cal[i][j][k] = new TH1F( hname.data(), htitle.data(),
-												8000, -0.25, 3999.75 );
-					
-					hfebex_cal[i][j][k]->SetDirectory( output_file->GetDirectory( dirname.data() ) );
-					
-				}
-				
-				// MWD energy
-				hname = "febex_" + std::to_string(i);
-				hname += "_" + std::to_string(j);
-				hname += "_" + std::to_string(k);
-				hname += "_mwd";
-				
-				htitle = "MWD FEBEX spectra for SFP " + std::to_string(i);
-				htitle += ", board " + std::to_string(j);
-				htitle += ", channel " + std::to_string(k);
-
-				htitle += ";Energy (keV);Counts per 0.5 keV";
-				
-				if( output_file->GetListOfKeys()->Contains( hname.data() ) )
-					hfebex_mwd[i][j][k] = (TH1F*)output_file->Get( hname.data() );
-				
-				else {
-					
-					hfebex_mwd[i][j][k] = new TH1F( hname.data(), htitle.data(),
-												65536, -0.5, 65535.5 );
-					
-					hfebex_mwd[i][j][k]->SetDirectory( output_file->GetDirectory( dirname.data() ) );
-					
-				}
+				hfebex[i][j][k] = nullptr;
+				hfebex_cal[i][j][k] = nullptr;
+				hfebex_mwd[i][j][k] = nullptr;
 				
-			} // k - channel
+			}
+			cnt_febex[i][j].resize( set->GetNumberOfFebexChannels() );
+			cnt_febex_cal[i][j].resize( set->GetNumberOfFebexChannels(), CountSpectrum( CAL_NBINS ) );
+			cnt_febex_mwd[i][j].resize( set->GetNumberOfFebexChannels() );
 
 		// Hit ID vs timestamp
 			hname  = "hfebex_hit_" + std::to_string(i);
@@ -197,13 +532,13 @@ void Converter::MakeHists() {
 			htitle = "Profile of ts versus hit_id in SFP " + std::to_string(i);
 			htitle += ", board " + std::to_string(j);
 
-			if( output_file->GetListOfKeys()->Contains( hname.data() ) )
-				hfebex_hit[i][j] = (TProfile*)output_file->Get( hname.data() );
+			if( dir->GetListOfKeys()->Contains( hname.data() ) )
+				hfebex_hit[i][j] = (TProfile*)dir->Get( hname.data() );
 			
 			else {
 				
 				hfebex_hit[i][j] = new TProfile( hname.data(), htitle.data(), 10800, 0., 108000., "" );
-				hfebex_hit[i][j]->SetDirectory( output_file->GetDirectory( dirname.data() ) );
+				hfebex_hit[i][j]->SetDirectory( dir );
 				
 			}
 
@@ -213,13 +548,13 @@ void Converter::MakeHists() {
 			htitle = "Profile of ts versus pause events in SFP " + std::to_string(i);
 			htitle += ", board " + std::to_string(j);
 
-			if( output_file->GetListOfKeys()->Contains( hname.data() ) )
-				hfebex_pause[i][j] = (TProfile*)output_file->Get( hname.data() );
+			if( dir->GetListOfKeys()->Contains( hname.data() ) )
+				hfebex_pause[i][j] = (TProfile*)dir->Get( hname.data() );
 			
 			else {
 				
 				hfebex_pause[i][j] = new TProfile( hname.data(), htitle.data(), 1000, 0., 10000., "" );
-				hfebex_pause[i][j]->SetDirectory( output_file->GetDirectory( dirname.data() ) );
+				hfebex_pause[i][j]->SetDirectory( dir );
 				
 			}
 			
@@ -229,13 +564,13 @@ void Converter::MakeHists() {
 			htitle = "Profile of ts versus resume events in SFP " + std::to_string(i);
 			htitle += ", board " + std::to_string(j);
 
-			if( output_file->GetListOfKeys()->Contains( hname.data() ) )
-				hfebex_resume[i][j] = (TProfile*)output_file->Get( hname.data() );
+			if( dir->GetListOfKeys()->Contains( hname.data() ) )
+				hfebex_resume[i][j] = (TProfile*)dir->Get( hname.data() );
 			
 			else {
 				
 				hfebex_resume[i][j] = new TProfile( hname.data(), htitle.data(), 1000, 0., 10000., "" );
-				hfebex_resume[i][j]->SetDirectory( output_file->GetDirectory( dirname.data() ) );
+				hfebex_resume[i][j]->SetDirectory( dir );
 				
 			}
 				
@@ -247,13 +582,13 @@ void Converter::MakeHists() {
 	hname = "hfebex_ext_ts";
 	htitle = "Profile of external trigger ts versus hit_id";
 
-	if( output_file->GetListOfKeys()->Contains( hname.data() ) )
-		hfebex_ext = (TProfile*)output_file->Get( hname.data() );
+	if( dir->GetListOfKeys()->Contains( hname.data() ) )
+		hfebex_ext = (TProfile*)dir->Get( hname.data() );
 	
 	else {
 		
 		hfebex_ext = new TProfile( hname.data(), htitle.data(), 10800, 0., 108000., "" );
-		hfebex_ext->SetDirectory( output_file->GetDirectory( dirname.data() ) );
+		hfebex_ext->SetDirectory( dir );
 		
 	}
 
@@ -261,780 +596,2604 @@ void Converter::MakeHists() {
 	
 }
 
-// Function to copy the header from a DataSpy, for example
-void Converter::SetBlockHeader( char *input_header ){
+// Make one of the spectra for a channel, the first time it's needed
+TH1F* Converter::MakeFebexHist( unsigned char sfp, unsigned char board, unsigned char ch,
+							   spec_t type ){
 	
-	// Copy header
-	for( unsigned int i = 0; i < HEADER_SIZE; i++ )
-		block_header[i] = input_header[i];
-
-	return;
+	std::string hname, htitle, dirname;
 	
-}
-
-// Function to process header words
-void Converter::ProcessBlockHeader( unsigned long nblock ){
-		
-	// For each new header, reset the swap mode
-	swap = 0;
+	dirname  = "sfp_" + std::to_string(sfp);
+	dirname += "/board_" + std::to_string(board);
 
-	// Flags for FEBEX data items
-	flag_febex_data0 = false;
-	flag_febex_data1 = false;
-	flag_febex_data2 = false;
-	flag_febex_data3 = false;
-	flag_febex_trace = false;
+	hname = "febex_" + std::to_string(sfp);
+	hname += "_" + std::to_string(board);
+	hname += "_" + std::to_string(ch);
+	
+	if( type == SPEC_RAW ) htitle = "Raw FEBEX spectra for SFP ";
+	else if( type == SPEC_CAL ) htitle = "Calibrated FEBEX spectra for SFP ";
+	else htitle = "MWD FEBEX spectra for SFP ";
+	htitle += std::to_string(sfp);
+	htitle += ", board " + std::to_string(board);
+	htitle += ", channel " + std::to_string(ch);
 
-	// Flag when we find the end of the data
-	flag_terminator = false;
+	if( type == SPEC_RAW ) htitle += ";Charge value;Counts";
+	else htitle += ";Energy (keV);Counts per 0.5 keV";
 
-	// Process header.
-	for( UInt_t i = 0; i < 8; i++ )
-		header_id[i] = block_header[i];
-	
-	header_sequence =
-	(block_header[8] & 0xFF) << 24 | (block_header[9]& 0xFF) << 16 |
-	(block_header[10]& 0xFF) << 8  | (block_header[11]& 0xFF);
+	if( type == SPEC_CAL ) hname += "_cal";
+	else if( type == SPEC_MWD ) hname += "_mwd";
 	
-	header_stream = (block_header[12] & 0xFF) << 8 | (block_header[13]& 0xFF);
+	TDirectory *dir = output_file->GetDirectory( dirname.data() );
+	if( dir && dir->GetListOfKeys()->Contains( hname.data() ) )
+		return (TH1F*)dir->Get( hname.data() );
 	
-	header_tape = (block_header[14] & 0xFF) << 8 | (block_header[15]& 0xFF);
+	TH1F *h;
+	if( type == SPEC_CAL )
+		h = new TH1F( hname.data(), htitle.data(), CAL_NBINS, CAL_MIN, CAL_MAX );
+	else
+		h = new TH1F( hname.data(), htitle.data(), 65536, -0.5, 65535.5 );
 	
-	header_MyEndian = (block_header[16] & 0xFF) << 8 | (block_header[17]& 0xFF);
+	h->SetDirectory( dir );
 	
-	header_DataEndian = (block_header[18] & 0xFF) << 8 | (block_header[19]& 0xFF);
+	return h;
 	
-	header_DataLen =
-	(block_header[20] & 0xFF) | (block_header[21]& 0xFF) << 8 |
-	(block_header[22] & 0xFF) << 16  | (block_header[23]& 0xFF) << 24 ;
-	
-	if( std::string(header_id).substr(0,8) != "EBYEDATA" ) {
-	
-		std::cerr << "Bad header in block " << nblock << std::endl;
-		exit(0);
+}
+
+// Empty the spectra that depend on the calibration, i.e. the calibrated
+// and MWD energies, when the calibration changes in the monitor
+void Converter::ResetCalHists(){
 	
+	for( unsigned int i = 0; i < hfebex_cal.size(); ++i ) {
+		
+		for( unsigned int j = 0; j < hfebex_cal[i].size(); ++j ) {
+			
+			for( unsigned int k = 0; k < hfebex_cal[i][j].size(); ++k ) {
+				
+				if( hfebex_cal[i][j][k] ) hfebex_cal[i][j][k]->Reset();
+				if( hfebex_mwd[i][j][k] ) hfebex_mwd[i][j][k]->Reset();
+				cnt_febex_cal[i][j][k].Clear();
+				cnt_febex_mwd[i][j][k].Clear();
+				
+			}
+			
+		}
+		
 	}
 	
 	return;
 	
 }
 
-
-// Function to copy the main data from a DataSpy, for example
-void Converter::SetBlockData( char *input_data ){
+// Move the counts for the raw, calibrated and MWD spectra in to the histograms.
+// This is done before they are written, or shown in the monitor.
+void Converter::UpdateHists(){
+	
+	for( unsigned int i = 0; i < cnt_febex.size(); ++i ) {
+		
+		for( unsigned int j = 0; j < cnt_febex[i].size(); ++j ) {
+			
+			for( unsigned int k = 0; k < cnt_febex[i][j].size(); ++k ) {
+				
+				if( cnt_febex[i][j][k].GetEntries() ) {
+					
+					if( !hfebex[i][j][k] ) hfebex[i][j][k] = MakeFebexHist( i, j, k, SPEC_RAW );
+					cnt_febex[i][j][k].AddTo( hfebex[i][j][k] );
+					
+				}
+				
+				if( cnt_febex_cal[i][j][k].GetEntries() ) {
+					
+					if( !hfebex_cal[i][j][k] ) hfebex_cal[i][j][k] = MakeFebexHist( i, j, k, SPEC_CAL );
+					cnt_febex_cal[i][j][k].AddTo( hfebex_cal[i][j][k] );
+					
+				}
+				
+				if( cnt_febex_mwd[i][j][k].GetEntries() ) {
+					
+					if( !hfebex_mwd[i][j][k] ) hfebex_mwd[i][j][k] = MakeFebexHist( i, j, k, SPEC_MWD );
+					cnt_febex_mwd[i][j][k].AddTo( hfebex_mwd[i][j][k] );
+					
+				}
+				
+			}
+			
+		}
+		
+	}
 	
-	// Copy header
-	for( UInt_t i = 0; i < MAIN_SIZE; i++ )
-		block_data[i] = input_data[i];
-
 	return;
 	
 }
 
-
-// Function to process data words
-void Converter::ProcessBlockData( unsigned long nblock ){
+// Set the size of the blocks, which must be more than just the header
+void Converter::SetBlockSize( unsigned int block_size ){
 	
-	// Get the data in 64-bit words and check endieness and swap if needed
-	// Data format here: http://npg.dl.ac.uk/documents/edoc504/edoc504.html
-	// Unpack in to two 32-bit words for purposes of data format
+	if( block_size <= HEADER_SIZE || block_size % sizeof(ULong64_t) ) {
 		
-	// Swap mode is unknown for the first block of data, so let's work it out
-	if( (swap & SWAP_KNOWN) == 0 ) {
-
-		// See if we can figure out the swapping - the DataEndian word of the
-		// header is 256 if the endianness is correct, otherwise swap endianness
-		if( header_DataEndian != 256 ) swap |= SWAP_ENDIAN;
-		
-		// However, that is not all, the words may also be swapped, so check
-		// for that. Bits 31:30 should always be zero in the timestamp word
-		for( UInt_t i = 0; i < WORD_SIZE; i++ ) {
-			ULong64_t word = (swap & SWAP_ENDIAN) ? Swap64(data[i]) : data[i];
-			if( word & 0xC000000000000000LL ) {
-				swap |= SWAP_KNOWN;
-				break;
-			}
-			if( word & 0x00000000C0000000LL ) {
-				swap |= SWAP_KNOWN;
-				swap |= SWAP_WORDS;
-				break;
-			}
-		}
+		std::cerr << "Bad block size " << block_size << ", using 64 kB" << std::endl;
+		block_size = 0x10000;
 		
 	}
+	
+	DATA_BLOCK_SIZE = block_size;
+	MAIN_SIZE = DATA_BLOCK_SIZE - HEADER_SIZE;
+	WORD_SIZE = MAIN_SIZE / sizeof(ULong64_t);
+	block_data_buf.resize( MAIN_SIZE );
+	block_data = block_data_buf.data();
+	
+	return;
+	
+}
 
+// Work out the block size from the start of the data. The header only
+// gives the length of the data actually used in the block, so we take
+// the smallest size that fits that and is followed by another header,
+// or by the end of the data. Returns 0 if it doesn't look like a block.
+unsigned int Converter::DetectBlockSize( const char *data, unsigned long long length ){
 	
-	// Process all words
-	for( UInt_t i = 0; i < WORD_SIZE; i++ ) {
-		
-		word = GetWord(i);
-		word_0 = (word & 0xFFFFFFFF00000000) >> 32;
-		word_1 = (word & 0x00000000FFFFFFFF);
-
-		// Check the trailer: reject or keep the block.
-		if( ( word_0 & 0xFFFFFFFF ) == 0xFFFFFFFF ||
-		    ( word_0 & 0xFFFFFFFF ) == 0x5E5E5E5E ||
-		    ( word_1 & 0xFFFFFFFF ) == 0xFFFFFFFF ||
-		    ( word_1 & 0xFFFFFFFF ) == 0x5E5E5E5E ){
-			
-			flag_terminator = true;
-			return;
-			
-		}
-		else if( i >= header_DataLen/sizeof(ULong64_t) ){
-			
-			flag_terminator = true;
-			return;
-
-		}
+	if( length < HEADER_SIZE ) return 0;
+	
+	DecodedBlock blk;
+	ProcessBlockHeader( data, blk );
+	if( !blk.flag_header ) return 0;
+	
+	for( unsigned int block_size = MIN_BLOCK_SIZE; block_size <= MAX_BLOCK_SIZE; block_size <<= 1 ) {
 		
-			
-		// Data type is highest two bits
-		my_type = ( word_0 >> 30 ) & 0x3;
+		if( block_size < blk.header_DataLen + HEADER_SIZE ) continue;
+		if( length < block_size + 8 ) return block_size;
+		if( std::string( data + block_size, 8 ) == "EBYEDATA" ) return block_size;
 		
-		// ADC data - we always assume it comes from FEBEX
-		if( my_type == 0x3 ){
-			
-			ProcessFebexData();
-			FinishFebexData();
+	}
+	
+	return 0;
+	
+}
 
-		}
+// Find the block size from the first block of a file, if the settings
+// ask us to. It is only done once for each file.
+void Converter::FindBlockSize( std::string input_file_name ){
+	
+	if( !flag_auto_block_size || block_size_file == input_file_name ) return;
+	
+	// Only regular files, we can't go back in a stream
+	struct stat input_stat;
+	if( stat( input_file_name.data(), &input_stat ) != 0 ||
+	    !S_ISREG( input_stat.st_mode ) )
+		return;
+	
+	// Look at the start of the file, uncompressed if need be
+	std::vector<char> start( MAX_BLOCK_SIZE + 8 );
+	unsigned long long length;
+	CompressedFile compressed_file;
+	if( compressed_file.Open( input_file_name ) )
+		length = compressed_file.Read( start.data(), start.size() );
+	
+	else {
 		
-		// Information data
-		else if( my_type == 0x2 ){
-			
-			ProcessInfoData();
-
-		}
+		std::ifstream input_file( input_file_name, std::ios::in|std::ios::binary );
+		input_file.read( start.data(), start.size() );
+		length = input_file.gcount();
 		
-		// Trace header
-		else if( my_type == 0x1 ){
-			
-			i = ProcessTraceData(i);
-			FinishFebexData();
-
-		}
+	}
+	
+	unsigned int block_size = DetectBlockSize( start.data(), length );
+	if( block_size == 0 ) {
 		
-		else {
-			
-			// output error message!
-			std::cerr << "WARNING: WRONG TYPE! word 0: " << word_0;
-			std::cerr << ", my_type: " << my_type << std::endl;
-			std::cerr << ", in bloc: " << nblock << std::endl;
-
-		}
-
-	} // loop - i < header_DataLen
+		std::cout << "Cannot find the block size of " << input_file_name;
+		std::cout << ", using " << DATA_BLOCK_SIZE << " bytes" << std::endl;
+		
+	}
+	
+	else SetBlockSize( block_size );
+	block_size_file = input_file_name;
 	
 	return;
-
+	
 }
 
-bool Converter::GetFebexChanID(){
-	
-	// ADCchannelIdent are bits 27:16 of word_0
-	// sfp_id= bit 11:10, board_id= bit 9:6, data_id= bit 5:4, ch_id= bit 3:0
-	// data_id: fast mode readout: =0 16 bit integer; =1 16 bit float;
-	//				=2 32 bit float (low 16 bits); =3 32 bit float (high 16 bits)
-	// 			standard mode readout: 0= 16 bit integer
-	unsigned int ADCchanIdent = (word_0 >> 16) & 0x0FFF; // 12 bits from 16
-	my_sfp_id = (ADCchanIdent >> 10) & 0x0003; // 2 bits from 10
-	my_board_id = (ADCchanIdent >> 6) & 0x000F; // 4 bits from 6
-	my_data_id = (ADCchanIdent >> 4) & 0x0003; // 2 bits from 4
-	my_ch_id = ADCchanIdent & 0x000F; // 4 bits from 0
+// Function to copy the header from a DataSpy, for example
+void Converter::SetBlockHeader( char *input_header ){
 	
-	// Check things make sense
-	if( my_sfp_id >= set->GetNumberOfFebexSfps() ||
-	    my_board_id >= set->GetNumberOfFebexBoards() ||
-	    my_ch_id >= set->GetNumberOfFebexChannels() ) {
-		
-		std::cout << "Bad FEBEX event with sfp_id=" << my_sfp_id;
-		std::cout << " board_id=" << my_board_id;
-		std::cout << " ch_id=" << my_ch_id;
-		std::cout << " data_id=" << my_data_id << std::endl;
-		return false;
+	// Copy header
+	for( unsigned int i = 0; i < HEADER_SIZE; i++ )
+		block_header_buf[i] = input_header[i];
+	block_header = block_header_buf;
 
-	}
+	return;
+	
+}
 
-	else return true;
+// Function to process header words
+void Converter::ProcessBlockHeader( const char *header, DecodedBlock &blk ){
+	
+	// Process header.
+	blk.header_sequence =
+	(header[8] & 0xFF) << 24 | (header[9]& 0xFF) << 16 |
+	(header[10]& 0xFF) << 8  | (header[11]& 0xFF);
+	
+	blk.header_DataEndian = (header[18] & 0xFF) << 8 | (header[19]& 0xFF);
+	
+	blk.header_DataLen =
+	(header[20] & 0xFF) | (header[21]& 0xFF) << 8 |
+	(header[22] & 0xFF) << 16  | (header[23]& 0xFF) << 24 ;
+	
+	// The first 8 bytes must be this string
+	blk.flag_header = std::string( header, 8 ) == "EBYEDATA";
+	
+	return;
 	
 }
 
-int Converter::ProcessTraceData( int pos ){
+
+// Function to copy the main data from a DataSpy, for example
+void Converter::SetBlockData( char *input_data ){
 	
-	// Channel ID, etc
-	if( !GetFebexChanID() ) return pos;
+	// Copy header
+	for( UInt_t i = 0; i < MAIN_SIZE; i++ )
+		block_data_buf[i] = input_data[i];
+	block_data = block_data_buf.data();
 
-	// reconstruct time stamp= MSB+LSB
-	my_tm_stp_lsb = word_1 & 0x0FFFFFFF;  // 28 bits from 0
-	my_tm_stp = ( my_tm_stp_msb << 28 ) | my_tm_stp_lsb;
+	return;
+	
+}
 
-	// Make a FebexData item
-	febex_data->SetTime( my_tm_stp );
-	febex_data->SetSfp( my_sfp_id );
-	febex_data->SetBoard( my_board_id );
-	febex_data->SetChannel( my_ch_id );
-	febex_data->SetFail( 0 );
-	febex_data->SetVeto( 0 );
 
-	// sample length
-	nsamples = word_0 & 0xFFFF; // 16 bits from 0
+// Swap a block one word at a time, works everywhere
+template<int swap>
+void Converter::SwapBlockScalar( const ULong64_t *in, ULong64_t *out, unsigned int n ){
 	
-	// Get the samples from the trace
-	for( UInt_t j = 0; j < nsamples; j++ ){
-		
-		// get next word
-		pos++;
-		sample_packet = GetWord(pos);
-		
-		block_test = ( sample_packet >> 32 ) & 0x00000000FFFFFFFF;
-		trace_test = ( sample_packet >> 62 ) & 0x0000000000000003;
+	for( unsigned int i = 0; i < n; ++i ) {
 		
-		if( trace_test == 0 && block_test != 0x5E5E5E5E ){
-			
-			febex_data->AddSample( ( sample_packet >> 48 ) & 0x0000000000003FFF );
-			febex_data->AddSample( ( sample_packet >> 32 ) & 0x0000000000003FFF );
-			febex_data->AddSample( ( sample_packet >> 16 ) & 0x0000000000003FFF );
-			febex_data->AddSample( sample_packet & 0x0000000000003FFF );
-			
-		}
+		ULong64_t word = in[i];
+		if( swap & SWAP_ENDIAN ) word = Swap64( word );
+		if( swap & SWAP_WORDS )  word = SwapWords( word );
+		out[i] = word;
 		
-		else {
-			
-			//std::cout << "This isn't a trace anymore..." << std::endl;
-			//std::cout << "Sample #" << j << " of " << nsamples << std::endl;
-			//std::cout << " trace_test = " << (int)trace_test << std::endl;
-
-			pos--;
-			break;
-			
-		}
-
 	}
 	
-	FebexMWD mwd = cal->DoMWD( my_sfp_id, my_board_id, my_ch_id, febex_data->GetTrace() );
-	for( unsigned int i = 0; i < mwd.NumberOfTriggers(); ++i )
-		hfebex_mwd[my_sfp_id][my_board_id][my_ch_id]->Fill( mwd.GetEnergy(i) );
+	return;
+	
+}
 
+// Unpack trace sample words, four 14-bit samples in each, with the first
+// sample in the top bits. Stops at the first word that isn't a sample.
+// A block terminator 0x5E5E5E5E has bits 63:62 set, so one test does both.
+// Returns the number of sample words.
+unsigned int Converter::UnpackTraceScalar( const ULong64_t *in, unsigned short *out, unsigned int n ){
 	
-	flag_febex_trace = true;
+	unsigned int i = 0;
+	for( ; i < n; ++i ) {
+		
+		ULong64_t word = in[i];
+		if( word >> 62 ) break;
+		
+		out[4*i]   = ( word >> 48 ) & 0x3FFF;
+		out[4*i+1] = ( word >> 32 ) & 0x3FFF;
+		out[4*i+2] = ( word >> 16 ) & 0x3FFF;
+		out[4*i+3] = word & 0x3FFF;
+		
+	}
+	
+	return i;
 	
-	return pos;
-
 }
 
-void Converter::ProcessFebexData(){
+#ifdef CONVERTER_SIMD_X86
 
-	// Febex data format
-	my_adc_data = word_0 & 0xFFFF; // 16 bits from 0
+// Swap a block with a byte shuffle, two words at a time.
+// The shuffle mask is found by swapping the byte numbers themselves.
+template<int swap> __attribute__((target("ssse3")))
+void Converter::SwapBlockSSSE3( const ULong64_t *in, ULong64_t *out, unsigned int n ){
 	
-	// Fail and veto bits (not used in FEBEX?)
-	my_veto = (word_0 >> 28) & 0x0001;
-	my_fail = (word_0 >> 29) & 0x0001;
-
-	// Channel ID, etc
-	if( !GetFebexChanID() ) return;
+	ULong64_t order[2] = { 0x0706050403020100LL, 0x0F0E0D0C0B0A0908LL };
+	SwapBlockScalar<swap>( order, order, 2 );
+	__m128i mask = _mm_loadu_si128( (const __m128i*)order );
 	
-	// reconstruct time stamp= MSB+LSB
-	my_tm_stp_lsb = word_1 & 0x0FFFFFFF;  // 28 bits from 0
-	my_tm_stp = ( my_tm_stp_msb << 28 ) | my_tm_stp_lsb;
+	unsigned int i = 0;
+	for( ; i + 2 <= n; i += 2 ) {
+		
+		__m128i words = _mm_loadu_si128( (const __m128i*)( in + i ) );
+		_mm_storeu_si128( (__m128i*)( out + i ), _mm_shuffle_epi8( words, mask ) );
+		
+	}
 	
-	// FEBEX timestamps are what precision?
-	// Can we multiply here to get to ns
-	//my_tm_stp = my_tm_stp*20;
+	SwapBlockScalar<swap>( in + i, out + i, n - i );
 	
-	// First of the data items
-	if( !flag_febex_data0 && !flag_febex_data1 &&
-	    !flag_febex_data2 && !flag_febex_data3 ){
-		
-		// Make a FebexData item
-		febex_data->SetTime( my_tm_stp );
-		febex_data->SetSfp( my_sfp_id );
-		febex_data->SetBoard( my_board_id );
-		febex_data->SetChannel( my_ch_id );
-		febex_data->SetFail( my_fail );
-		febex_data->SetVeto( my_veto );
+	return;
+	
+}
 
-	}
+// Same again, four words at a time
+template<int swap> __attribute__((target("avx2")))
+void Converter::SwapBlockAVX2( const ULong64_t *in, ULong64_t *out, unsigned int n ){
 	
-	// If we already have all the data items, then the next event has
-	// already occured before we found traces. This means that there
-	// is not trace data. So set the flag to be true and finish the
-	// event with an empty trace.
-	else if( flag_febex_data0 && flag_febex_data1 &&
-			 flag_febex_data2 && flag_febex_data3 ){
+	ULong64_t order[4] = { 0x0706050403020100LL, 0x0F0E0D0C0B0A0908LL,
+						   0x0706050403020100LL, 0x0F0E0D0C0B0A0908LL };
+	SwapBlockScalar<swap>( order, order, 4 );
+	__m256i mask = _mm256_loadu_si256( (const __m256i*)order );
+	
+	unsigned int i = 0;
+	for( ; i + 4 <= n; i += 4 ) {
+		
+		__m256i words = _mm256_loadu_si256( (const __m256i*)( in + i ) );
+		_mm256_storeu_si256( (__m256i*)( out + i ), _mm256_shuffle_epi8( words, mask ) );
 		
-		// Finish up the previous event
-		FinishFebexData();
-
-		// Then set the info correctly for this event
-		febex_data->SetTime( my_tm_stp );
-		febex_data->SetSfp( my_sfp_id );
-		febex_data->SetBoard( my_board_id );
-		febex_data->SetChannel( my_ch_id );
-		febex_data->SetFail( my_fail );
-		febex_data->SetVeto( my_veto );
-
 	}
 	
-	// If we're in standard readout mode, the next event will be with
-	// data_id of 0 again. So we close the event by faking a full set
-	else if( flag_febex_data0 && !flag_febex_data1 && my_data_id == 0 ){
-		
-		// Fake all other data items
-		flag_febex_data1 = true;
-		flag_febex_data2 = true;
-		flag_febex_data3 = true;
-
-		// Finish up the previous event
-		FinishFebexData();
+	SwapBlockScalar<swap>( in + i, out + i, n - i );
+	
+	return;
+	
+}
 
-		// Then set the info correctly for this event
-		febex_data->SetTime( my_tm_stp );
-		febex_data->SetSfp( my_sfp_id );
-		febex_data->SetBoard( my_board_id );
-		febex_data->SetChannel( my_ch_id );
-		febex_data->SetFail( my_fail );
-		febex_data->SetVeto( my_veto );
+// Unpack trace samples two words at a time. The shuffle reverses the
+// order of the four samples in each word, then the top bits are masked.
+// Any group with a word that isn't a sample is left to the scalar kernel.
+__attribute__((target("ssse3")))
+unsigned int Converter::UnpackTraceSSSE3( const ULong64_t *in, unsigned short *out, unsigned int n ){
+	
+	const __m128i order = _mm_setr_epi8( 6, 7, 4, 5, 2, 3, 0, 1, 14, 15, 12, 13, 10, 11, 8, 9 );
+	const __m128i mask = _mm_set1_epi16( 0x3FFF );
+	
+	unsigned int i = 0;
+	for( ; i + 2 <= n; i += 2 ) {
+		
+		__m128i words = _mm_loadu_si128( (const __m128i*)( in + i ) );
+		__m128i test = _mm_or_si128( words, _mm_slli_epi64( words, 1 ) );
+		if( _mm_movemask_pd( _mm_castsi128_pd( test ) ) ) break;
+		
+		__m128i samples = _mm_and_si128( _mm_shuffle_epi8( words, order ), mask );
+		_mm_storeu_si128( (__m128i*)( out + 4*i ), samples );
 		
 	}
 	
-	// 16-bit integer energy
-	if( my_data_id == 0 ) {
+	return i + UnpackTraceScalar( in + i, out + 4*i, n - i );
+	
+}
+
+// Same again, four words at a time
+__attribute__((target("avx2")))
+unsigned int Converter::UnpackTraceAVX2( const ULong64_t *in, unsigned short *out, unsigned int n ){
+	
+	const __m256i order = _mm256_setr_epi8( 6, 7, 4, 5, 2, 3, 0, 1, 14, 15, 12, 13, 10, 11, 8, 9,
+										   6, 7, 4, 5, 2, 3, 0, 1, 14, 15, 12, 13, 10, 11, 8, 9 );
+	const __m256i mask = _mm256_set1_epi16( 0x3FFF );
+	
+	unsigned int i = 0;
+	for( ; i + 4 <= n; i += 4 ) {
 		
-		// Fill histograms
-		my_energy = cal->FebexEnergy( my_sfp_id, my_board_id, my_ch_id, my_adc_data );
-		hfebex[my_sfp_id][my_board_id][my_ch_id]->Fill( my_adc_data );
-		hfebex_cal[my_sfp_id][my_board_id][my_ch_id]->Fill( my_energy );
+		__m256i words = _mm256_loadu_si256( (const __m256i*)( in + i ) );
+		__m256i test = _mm256_or_si256( words, _mm256_slli_epi64( words, 1 ) );
+		if( _mm256_movemask_pd( _mm256_castsi256_pd( test ) ) ) break;
 		
-		febex_data->SetQint( my_adc_data );
-		febex_data->SetEnergy( my_energy );
+		__m256i samples = _mm256_and_si256( _mm256_shuffle_epi8( words, order ), mask );
+		_mm256_storeu_si256( (__m256i*)( out + 4*i ), samples );
+		
+	}
+	
+	return i + UnpackTraceScalar( in + i, out + 4*i, n - i );
+	
+}
 
-		// Check if it's over threshold
-		if( my_adc_data > cal->FebexThreshold( my_sfp_id, my_board_id, my_ch_id ) )
-			febex_data->SetThreshold( true );
-		else febex_data->SetThreshold( false );
+#else
 
-		flag_febex_data0 = true;
+// No SIMD kernels for this CPU, so these are never selected
+template<int swap>
+void Converter::SwapBlockSSSE3( const ULong64_t *in, ULong64_t *out, unsigned int n ){
+	SwapBlockScalar<swap>( in, out, n );
+}
 
-	}
-	
-	// 16-bit float
-	if( my_data_id == 1 ) {
-		
-		febex_data->SetQhalf( (Float16_t)(my_adc_data&0xFFFF) );
-		flag_febex_data1 = true;
+template<int swap>
+void Converter::SwapBlockAVX2( const ULong64_t *in, ULong64_t *out, unsigned int n ){
+	SwapBlockScalar<swap>( in, out, n );
+}
 
-	}
+unsigned int Converter::UnpackTraceSSSE3( const ULong64_t *in, unsigned short *out, unsigned int n ){
+	return UnpackTraceScalar( in, out, n );
+}
 
-	// 32-bit float (low 16 bits)
-	if( my_data_id == 2 ) {
-		
-		my_adc_data_lsb = my_adc_data&0xFFFF;
-		flag_febex_data2 = true;
+unsigned int Converter::UnpackTraceAVX2( const ULong64_t *in, unsigned short *out, unsigned int n ){
+	return UnpackTraceScalar( in, out, n );
+}
 
-	}
+#endif
+
+// Pick the fastest kernel for each swap mode, indexed by swap >> 1,
+// and for unpacking the trace samples
+void Converter::SelectKernels(){
+	
+	swap_block[0] = SwapBlockScalar<0>;
+	swap_block[1] = SwapBlockScalar<SWAP_WORDS>;
+	swap_block[2] = SwapBlockScalar<SWAP_ENDIAN>;
+	swap_block[3] = SwapBlockScalar<SWAP_ENDIAN|SWAP_WORDS>;
+	unpack_trace = UnpackTraceScalar;
+	
+#ifdef CONVERTER_SIMD_X86
+	
+	if( __builtin_cpu_supports( "avx2" ) ) {
+		
+		swap_block[1] = SwapBlockAVX2<SWAP_WORDS>;
+		swap_block[2] = SwapBlockAVX2<SWAP_ENDIAN>;
+		swap_block[3] = SwapBlockAVX2<SWAP_ENDIAN|SWAP_WORDS>;
+		unpack_trace = UnpackTraceAVX2;
+		
+	}
+	
+	else if( __builtin_cpu_supports( "ssse3" ) ) {
+		
+		swap_block[1] = SwapBlockSSSE3<SWAP_WORDS>;
+		swap_block[2] = SwapBlockSSSE3<SWAP_ENDIAN>;
+		swap_block[3] = SwapBlockSSSE3<SWAP_ENDIAN|SWAP_WORDS>;
+		unpack_trace = UnpackTraceSSSE3;
+		
+	}
+	
+#endif
+	
+	return;
+	
+}
+
+// Function to process data words.
+// This only depends on the block itself, so it is safe to call for
+// different blocks at the same time from different threads.
+void Converter::ProcessBlockData( const ULong64_t *data, DecodedBlock &blk ){
+	
+	// Get the data in 64-bit words and check endieness and swap if needed
+	// Data format here: http://npg.dl.ac.uk/documents/edoc504/edoc504.html
+	// Unpack in to two 32-bit words for purposes of data format
+		
+	// Swap mode is unknown for each block of data, so let's work it out
+	int swap = 0;
+
+	// See if we can figure out the swapping - the DataEndian word of the
+	// header is 256 if the endianness is correct, otherwise swap endianness
+	if( blk.header_DataEndian != 256 ) swap |= SWAP_ENDIAN;
+	
+	// However, that is not all, the words may also be swapped, so check
+	// for that. Bits 31:30 should always be zero in the timestamp word.
+	// Swap the masks rather than every word to test them.
+	ULong64_t mask_type = 0xC000000000000000LL;
+	ULong64_t mask_tstp = 0x00000000C0000000LL;
+	if( swap & SWAP_ENDIAN ) {
+		mask_type = Swap64( mask_type );
+		mask_tstp = Swap64( mask_tstp );
+	}
+	
+	for( UInt_t i = 0; i < WORD_SIZE; i++ ) {
+		if( data[i] & mask_type ) {
+			swap |= SWAP_KNOWN;
+			break;
+		}
+		if( data[i] & mask_tstp ) {
+			swap |= SWAP_KNOWN;
+			swap |= SWAP_WORDS;
+			break;
+		}
+	}
+	
+	// Swap the whole block in one go, then everything after this can
+	// just read the words as they are
+	if( swap & ( SWAP_ENDIAN | SWAP_WORDS ) ) {
+		
+		blk.native.resize( WORD_SIZE );
+		swap_block[ ( swap >> 1 ) & 0x3 ]( data, blk.native.data(), WORD_SIZE );
+		data = blk.native.data();
+		
+	}
+
+	
+	// Process all words
+	for( UInt_t i = 0; i < WORD_SIZE; i++ ) {
+		
+		ULong64_t word = data[i];
+		UInt_t word_0 = (word & 0xFFFFFFFF00000000) >> 32;
+		UInt_t word_1 = (word & 0x00000000FFFFFFFF);
+
+		// Check the trailer: reject or keep the block.
+		if( ( word_0 & 0xFFFFFFFF ) == 0xFFFFFFFF ||
+		    ( word_0 & 0xFFFFFFFF ) == 0x5E5E5E5E ||
+		    ( word_1 & 0xFFFFFFFF ) == 0xFFFFFFFF ||
+		    ( word_1 & 0xFFFFFFFF ) == 0x5E5E5E5E ){
+			
+			blk.flag_terminator = true;
+			return;
+			
+		}
+		else if( i >= blk.header_DataLen/sizeof(ULong64_t) ){
+			
+			blk.flag_terminator = true;
+			return;
+
+		}
+		
+		// Keep the word for processing in order later
+		blk.words.push_back( word );
+		
+		// Calibrate the FEBEX data here, while we are in parallel
+		if( ( ( word_0 >> 30 ) & 0x3 ) == 0x3 )
+			DecodeFebexData( word, blk );
+		
+		// Trace headers are followed by the samples, so unpack them here
+		else if( ( ( word_0 >> 30 ) & 0x3 ) == 0x1 )
+			i = DecodeTraceData( data, i, blk );
+
+	} // loop - i < header_DataLen
+	
+	return;
+
+}
+
+// Everything about a FEBEX data word that only needs the calibration.
+// There's one for every data word, even bad ones, to stay in step.
+void Converter::DecodeFebexData( ULong64_t word, DecodedBlock &blk ){
+	
+	blk.febex.emplace_back();
+	DecodedFebex &fc = blk.febex.back();
+	fc.energy = 0;
+	fc.cal_bin = 0;
+	fc.threshold = false;
+	fc.time = 0;
+	
+	// No calibration when we are only indexing
+	if( flag_index_only ) return;
+	
+	// Same bits as GetFebexChanID
+	UInt_t word_0 = ( word >> 32 ) & 0xFFFFFFFF;
+	unsigned int ADCchanIdent = (word_0 >> 16) & 0x0FFF; // 12 bits from 16
+	unsigned char sfp_id = (ADCchanIdent >> 10) & 0x0003; // 2 bits from 10
+	unsigned char board_id = (ADCchanIdent >> 6) & 0x000F; // 4 bits from 6
+	unsigned char data_id = (ADCchanIdent >> 4) & 0x0003; // 2 bits from 4
+	unsigned char ch_id = ADCchanIdent & 0x000F; // 4 bits from 0
+	if( sfp_id >= set->GetNumberOfFebexSfps() ||
+	    board_id >= set->GetNumberOfFebexBoards() ||
+	    ch_id >= set->GetNumberOfFebexChannels() )
+		return;
+	
+	// Everything comes from the one entry for this channel
+	const FebexChannelCal &c = cal->GetFebexCal( cal->GetFebexIndex( sfp_id, board_id, ch_id ) );
+	fc.time = c.time;
+	
+	// Energy only for the 16-bit integer data
+	if( data_id != 0 ) return;
+	unsigned short adc_data = word_0 & 0xFFFF; // 16 bits from 0
+	fc.energy = cal->FebexEnergy( c, adc_data );
+	fc.threshold = adc_data > c.threshold;
+	
+	// Same bin as TH1::FindBin, NaN goes in the underflow
+	if( !( fc.energy >= CAL_MIN ) ) fc.cal_bin = 0;
+	else if( fc.energy >= CAL_MAX ) fc.cal_bin = CAL_NBINS + 1;
+	else fc.cal_bin = 1 + (unsigned int)( CAL_NBINS * ( fc.energy - CAL_MIN ) / ( CAL_MAX - CAL_MIN ) );
+	
+	return;
+	
+}
+
+// Unpack the samples after a trace header and run the MWD on them.
+// Returns the position of the last sample word.
+unsigned int Converter::DecodeTraceData( const ULong64_t *data,
+										unsigned int pos, DecodedBlock &blk ){
+	
+	// Always add a trace, so they stay in step with the trace headers.
+	// The buffers are kept from block to block, so they rarely need to grow.
+	if( blk.ntraces == blk.traces.size() ) {
+		
+		blk.traces.emplace_back();
+		blk.mwd_energies.emplace_back();
+		
+	}
+	std::vector<unsigned short> &trace = blk.traces[blk.ntraces];
+	blk.mwd_energies[blk.ntraces].clear();
+	blk.ntraces++;
+	
+	// Trace headers have a time offset too, but nothing else
+	blk.febex.emplace_back();
+	DecodedFebex &fc = blk.febex.back();
+	fc.energy = 0;
+	fc.cal_bin = 0;
+	fc.threshold = false;
+	fc.time = 0;
+
+	// Channel ID, etc
+	UInt_t word_0 = ( GetWord( data, pos ) >> 32 ) & 0xFFFFFFFF;
+	unsigned int ADCchanIdent = (word_0 >> 16) & 0x0FFF; // 12 bits from 16
+	unsigned char sfp_id = (ADCchanIdent >> 10) & 0x0003; // 2 bits from 10
+	unsigned char board_id = (ADCchanIdent >> 6) & 0x000F; // 4 bits from 6
+	unsigned char ch_id = ADCchanIdent & 0x000F; // 4 bits from 0
+
+	// Bad channels don't get their samples read, same as GetFebexChanID
+	if( sfp_id >= set->GetNumberOfFebexSfps() ||
+	    board_id >= set->GetNumberOfFebexBoards() ||
+	    ch_id >= set->GetNumberOfFebexChannels() )
+		return pos;
+
+	// sample length, but the trace can't go past the end of the block
+	unsigned int nsamples = word_0 & 0xFFFF; // 16 bits from 0
+	if( pos + 1 + nsamples > WORD_SIZE ) nsamples = WORD_SIZE - pos - 1;
+	
+	// Unpack all the sample words in one go, it stops early if we
+	// find a word that isn't a sample, i.e. the trace was cut short
+	trace.resize( 4 * nsamples );
+	nsamples = unpack_trace( data + pos + 1, trace.data(), nsamples );
+	trace.resize( 4 * nsamples );
+	pos += nsamples;
+	
+	// The samples aren't needed if we are only indexing
+	if( flag_index_only ) {
+		
+		trace.clear();
+		return pos;
+		
+	}
+	
+	fc.time = cal->GetFebexCal( cal->GetFebexIndex( sfp_id, board_id, ch_id ) ).time;
+	cal->DoMWD( sfp_id, board_id, ch_id, trace, blk.mwd );
+	for( unsigned int i = 0; i < blk.mwd.NumberOfTriggers(); ++i )
+		blk.mwd_energies[blk.ntraces-1].push_back( blk.mwd.GetEnergy(i) );
+	
+	return pos;
+	
+}
+
+// Decode a whole block, header and data, without touching the state
+// that is carried from one block to the next
+void Converter::DecodeBlock( const char *header, const char *data,
+							unsigned long nblock, DecodedBlock &blk ){
+	
+	// Start from an empty block
+	blk.nblock = nblock;
+	blk.flag_terminator = false;
+	blk.words.clear();
+	blk.febex.clear();
+	blk.ntraces = 0;
+	
+	// Header first, then the data if the header makes sense
+	ProcessBlockHeader( header, blk );
+	if( blk.flag_header )
+		ProcessBlockData( (const ULong64_t *)(data), blk );
+	
+	return;
+	
+}
+
+// Other files are printing their progress too, so just one
+// line every 10%, written in one go so the lines don't get mixed
+void Converter::PrintJobProgress( std::string stage, float percent ){
+	
+	if( stage != job_stage ) {
+		
+		job_stage = stage;
+		job_percent = -10;
+		
+	}
+	
+	int step = (int)percent / 10 * 10;
+	if( step <= job_percent ) return;
+	job_percent = step;
+	
+	std::stringstream ss;
+	ss << " " << job_name << ": " << job_stage << " " << step << "%" << std::endl;
+	std::cout << ss.str();
+	
+	return;
+	
+}
+
+// Decode the blocks in the current batch, sharing them between threads
+void Converter::DecodeBatch( unsigned int nbatch ){
+	
+	// Single thread, or nothing to share
+	if( nthreads <= 1 || nbatch <= 1 ) {
+		
+		for( unsigned int i = 0; i < nbatch; ++i )
+			DecodeBlock( batch_blocks[i], batch_blocks[i] + HEADER_SIZE,
+							 decoded[i].nblock, decoded[i] );
+		
+		return;
+		
+	}
+	
+	if( decode_threads.empty() ) StartDecodeThreads();
+	
+	// Hand the batch to the threads, then wait for them to finish it
+	{
+		std::lock_guard<std::mutex> lk( decode_lock );
+		decode_nbatch = nbatch;
+		decode_next = 0;
+		decode_nbusy = decode_threads.size();
+		decode_generation++;
+	}
+	decode_start.notify_all();
+	
+	std::unique_lock<std::mutex> lk( decode_lock );
+	decode_finish.wait( lk, [this]{ return decode_nbusy == 0; } );
+	
+	return;
+	
+}
+
+// Each thread takes the next block in the batch until there are none left,
+// then waits for the next batch
+void Converter::DecodeThread(){
+	
+	unsigned long generation = 0;
+	while( true ) {
+		
+		{
+			std::unique_lock<std::mutex> lk( decode_lock );
+			decode_start.wait( lk, [this,generation]{
+				return decode_stop || decode_generation != generation; } );
+			if( decode_stop ) return;
+			generation = decode_generation;
+		}
+		
+		unsigned int i;
+		while( ( i = decode_next++ ) < decode_nbatch )
+			DecodeBlock( batch_blocks[i], batch_blocks[i] + HEADER_SIZE,
+						 decoded[i].nblock, decoded[i] );
+		
+		{
+			std::lock_guard<std::mutex> lk( decode_lock );
+			if( --decode_nbusy == 0 ) decode_finish.notify_one();
+		}
+		
+	}
+	
+}
+
+void Converter::StartDecodeThreads(){
+	
+	decode_stop = false;
+	for( unsigned int j = 0; j < nthreads; ++j )
+		decode_threads.emplace_back( &Converter::DecodeThread, this );
+	
+	return;
+	
+}
+
+void Converter::StopDecodeThreads(){
+	
+	if( decode_threads.empty() ) return;
+	
+	{
+		std::lock_guard<std::mutex> lk( decode_lock );
+		decode_stop = true;
+	}
+	decode_start.notify_all();
+	
+	for( unsigned int j = 0; j < decode_threads.size(); ++j )
+		decode_threads[j].join();
+	decode_threads.clear();
+	
+	return;
+	
+}
+
+void Converter::SetNumberOfThreads( int n ){
+	
+	// Any threads we have are for the old number
+	StopDecodeThreads();
+	
+	unsigned int ncores = std::thread::hardware_concurrency();
+	if( n < 1 ) nthreads = 1;
+	else if( ncores > 0 && (unsigned int)n > ncores ) nthreads = ncores;
+	else nthreads = n;
+	
+	if( nthreads > 1 ) ROOT::EnableThreadSafety();
+	
+	return;
+	
+}
+
+// Process the decoded words of a block in order. This is where the
+// state from previous blocks, i.e. the extended timestamp, is applied.
+bool Converter::ProcessDecodedBlock( DecodedBlock &blk ){
+	
+	// Bad header means we cannot trust anything
+	if( !blk.flag_header ) {
+	
+		std::cerr << "Bad header in block " << blk.nblock << std::endl;
+		exit(0);
+	
+	}
+	
+	// The flags for FEBEX data items used to be reset at every block
+	// header. They carry on now, because a hit can have its data items
+	// split over two blocks, and resetting them threw that hit away.
+	// A hit that really is incomplete is still dropped by the checks in
+	// ProcessFebexData and FinishFebexData, as it is within a block.
+	
+	// Process all words
+	unsigned int ntrace = 0;
+	unsigned int nfebex = 0;
+	for( unsigned int i = 0; i < blk.words.size(); i++ ) {
+		
+		word_0 = (blk.words[i] & 0xFFFFFFFF00000000) >> 32;
+		word_1 = (blk.words[i] & 0x00000000FFFFFFFF);
+
+		// Data type is highest two bits
+		my_type = ( word_0 >> 30 ) & 0x3;
+		
+		// ADC data - we always assume it comes from FEBEX
+		if( my_type == 0x3 ){
+			
+			ProcessFebexData( blk.febex[nfebex++] );
+			FinishFebexData();
+
+		}
+		
+		// Information data
+		else if( my_type == 0x2 ){
+			
+			ProcessInfoData();
+
+		}
+		
+		// Trace header
+		else if( my_type == 0x1 ){
+			
+			ProcessTraceData( blk, ntrace++, blk.febex[nfebex++] );
+			FinishFebexData();
+
+		}
+		
+		else {
+			
+			// output error message!
+			std::cerr << "WARNING: WRONG TYPE! word 0: " << word_0;
+			std::cerr << ", my_type: " << my_type << std::endl;
+			std::cerr << ", in bloc: " << blk.nblock << std::endl;
+
+		}
+
+	} // loop - i < words.size()
+	
+	// Check once more after going over left overs....
+	if( !blk.flag_terminator ){
+
+		std::cout << std::endl << __PRETTY_FUNCTION__ << std::endl;
+		std::cout << "\tERROR - Terminator sequence not found in data.\n";
+		return false;
+		
+	}
+
+	return true;
+
+}
+
+bool Converter::GetFebexChanID(){
+	
+	// ADCchannelIdent are bits 27:16 of word_0
+	// sfp_id= bit 11:10, board_id= bit 9:6, data_id= bit 5:4, ch_id= bit 3:0
+	// data_id: fast mode readout: =0 16 bit integer; =1 16 bit float;
+	//				=2 32 bit float (low 16 bits); =3 32 bit float (high 16 bits)
+	// 			standard mode readout: 0= 16 bit integer
+	unsigned int ADCchanIdent = (word_0 >> 16) & 0x0FFF; // 12 bits from 16
+	my_sfp_id = (ADCchanIdent >> 10) & 0x0003; // 2 bits from 10
+	my_board_id = (ADCchanIdent >> 6) & 0x000F; // 4 bits from 6
+	my_data_id = (ADCchanIdent >> 4) & 0x0003; // 2 bits from 4
+	my_ch_id = ADCchanIdent & 0x000F; // 4 bits from 0
+	
+	// Check things make sense
+	if( my_sfp_id >= set->GetNumberOfFebexSfps() ||
+	    my_board_id >= set->GetNumberOfFebexBoards() ||
+	    my_ch_id >= set->GetNumberOfFebexChannels() ) {
+		
+		std::cout << "Bad FEBEX event with sfp_id=" << my_sfp_id;
+		std::cout << " board_id=" << my_board_id;
+		std::cout << " ch_id=" << my_ch_id;
+		std::cout << " data_id=" << my_data_id << std::endl;
+		return false;
+
+	}
+
+	else return true;
+	
+}
+
+void Converter::ProcessTraceData( DecodedBlock &blk, unsigned int idx, const DecodedFebex &fc ){
+	
+	// Channel ID, etc
+	if( !GetFebexChanID() ) return;
+
+	// reconstruct time stamp= MSB+LSB
+	my_tm_stp_lsb = word_1 & 0x0FFFFFFF;  // 28 bits from 0
+	my_tm_stp = ( my_tm_stp_msb << 28 ) | my_tm_stp_lsb;
+
+	// Make a FebexData item
+	febex_data->SetTime( my_tm_stp );
+	febex_data->SetSfp( my_sfp_id );
+	febex_data->SetBoard( my_board_id );
+	febex_data->SetChannel( my_ch_id );
+	febex_data->SetFail( 0 );
+	febex_data->SetVeto( 0 );
+	my_time_offset = fc.time;
+
+	// The samples were already unpacked when the block was decoded
+	febex_data->SetTrace( blk.traces[idx] );
+	
+	for( unsigned int i = 0; i < blk.mwd_energies[idx].size(); ++i )
+		cnt_febex_mwd[my_sfp_id][my_board_id][my_ch_id].Fill( blk.mwd_energies[idx][i] );
+
+	
+	flag_febex_trace = true;
+	
+	return;
+
+}
+
+void Converter::ProcessFebexData( const DecodedFebex &fc ){
+
+	// Febex data format
+	my_adc_data = word_0 & 0xFFFF; // 16 bits from 0
+	
+	// Fail and veto bits (not used in FEBEX?)
+	my_veto = (word_0 >> 28) & 0x0001;
+	my_fail = (word_0 >> 29) & 0x0001;
+
+	// Channel ID, etc
+	if( !GetFebexChanID() ) return;
+	
+	// reconstruct time stamp= MSB+LSB
+	my_tm_stp_lsb = word_1 & 0x0FFFFFFF;  // 28 bits from 0
+	my_tm_stp = ( my_tm_stp_msb << 28 ) | my_tm_stp_lsb;
+	
+	// FEBEX timestamps are what precision?
+	// Can we multiply here to get to ns
+	//my_tm_stp = my_tm_stp*20;
+	
+	// First of the data items
+	if( !flag_febex_data0 && !flag_febex_data1 &&
+	    !flag_febex_data2 && !flag_febex_data3 ){
+		
+		// Make a FebexData item
+		febex_data->SetTime( my_tm_stp );
+		febex_data->SetSfp( my_sfp_id );
+		febex_data->SetBoard( my_board_id );
+		febex_data->SetChannel( my_ch_id );
+		febex_data->SetFail( my_fail );
+		febex_data->SetVeto( my_veto );
+		my_time_offset = fc.time;
+
+	}
+	
+	// If we already have all the data items, then the next event has
+	// already occured before we found traces. This means that there
+	// is not trace data. So set the flag to be true and finish the
+	// event with an empty trace.
+	else if( flag_febex_data0 && flag_febex_data1 &&
+			 flag_febex_data2 && flag_febex_data3 ){
+		
+		// Finish up the previous event
+		FinishFebexData();
+
+		// Then set the info correctly for this event
+		febex_data->SetTime( my_tm_stp );
+		febex_data->SetSfp( my_sfp_id );
+		febex_data->SetBoard( my_board_id );
+		febex_data->SetChannel( my_ch_id );
+		febex_data->SetFail( my_fail );
+		febex_data->SetVeto( my_veto );
+		my_time_offset = fc.time;
+
+	}
+	
+	// If we're in standard readout mode, the next event will be with
+	// data_id of 0 again. So we close the event by faking a full set
+	else if( flag_febex_data0 && !flag_febex_data1 && my_data_id == 0 ){
+		
+		// Fake all other data items
+		flag_febex_data1 = true;
+		flag_febex_data2 = true;
+		flag_febex_data3 = true;
+
+		// Finish up the previous event
+		FinishFebexData();
+
+		// Then set the info correctly for this event
+		febex_data->SetTime( my_tm_stp );
+		febex_data->SetSfp( my_sfp_id );
+		febex_data->SetBoard( my_board_id );
+		febex_data->SetChannel( my_ch_id );
+		febex_data->SetFail( my_fail );
+		febex_data->SetVeto( my_veto );
+		my_time_offset = fc.time;
+		
+	}
+	
+	// 16-bit integer energy
+	if( my_data_id == 0 ) {
+		
+		// Fill histograms, the energy was calibrated when it was decoded
+		my_energy = fc.energy;
+		cnt_febex[my_sfp_id][my_board_id][my_ch_id].Fill( my_adc_data );
+		cnt_febex_cal[my_sfp_id][my_board_id][my_ch_id].FillBin( fc.cal_bin );
+		
+		febex_data->SetQint( my_adc_data );
+		febex_data->SetEnergy( my_energy );
+
+		// Check if it's over threshold
+		febex_data->SetThreshold( fc.threshold );
+
+		flag_febex_data0 = true;
+
+	}
+	
+	// 16-bit float
+	if( my_data_id == 1 ) {
+		
+		febex_data->SetQhalf( (Float16_t)(my_adc_data&0xFFFF) );
+		flag_febex_data1 = true;
+
+	}
+
+	// 32-bit float (low 16 bits)
+	if( my_data_id == 2 ) {
+		
+		my_adc_data_lsb = my_adc_data&0xFFFF;
+		flag_febex_data2 = true;
+
+	}
 
 	// 32-bit float (high 16 bits)
 	if( my_data_id == 3 ) {
 		
-		my_adc_data_hsb = my_adc_data&0xFFFF;
-		flag_febex_data3 = true;
+		my_adc_data_hsb = my_adc_data&0xFFFF;
+		flag_febex_data3 = true;
+
+	}
+
+
+	return;
+
+}
+
+void Converter::FinishFebexData(){
+	
+	// Timestamp with offset
+	unsigned long long time_corr;
+	
+	// Got all items in fast readout mode or trace only mode
+	if( ( flag_febex_data0 && flag_febex_data1 &&
+	    flag_febex_data2 && flag_febex_data3 ) || flag_febex_trace ){
+
+		// Add the time offset to this channel
+		time_corr  = febex_data->GetTime();
+		time_corr += my_time_offset;
+
+		// Combine the two halfs of the floating point ADC energy
+		my_adc_data_float = ( my_adc_data_hsb << 16 ) | ( my_adc_data_lsb & 0xFFFF );
+		
+		// Check if this is actually just a timestamp or info like event
+		flag_febex_info = false;
+		if( febex_data->GetSfp()     == set->GetPulserSfp()     &&
+		    febex_data->GetBoard()   == set->GetPulserBoard()   &&
+		    febex_data->GetChannel() == set->GetPulserChannel() ){
+			
+			flag_febex_info = true;
+			my_info_code = 20; // Pulser is always 20 (defined here)
+			hfebex_ext->Fill( ctr_febex_ext, febex_data->GetTime(), 1 );
+			ctr_febex_ext++;
+
+		}
+		
+		else if( febex_data->GetSfp()     == set->GetEBISSfp()     &&
+				 febex_data->GetBoard()   == set->GetEBISBoard()   &&
+				 febex_data->GetChannel() == set->GetEBISChannel() ){
+			
+			flag_febex_info = true;
+			my_info_code = 21; // EBIS is always 21 (defined here)
+			
+		}
+		
+		else if( febex_data->GetSfp()     == set->GetT1Sfp()     &&
+				 febex_data->GetBoard()   == set->GetT1Board()   &&
+				 febex_data->GetChannel() == set->GetT1Channel() ){
+			
+			flag_febex_info = true;
+			my_info_code = 22; // T1 is always 22 (defined here)
+			
+		}
+
+		// If this is a timestamp, fill an info event
+		if( flag_febex_info ) {
+				
+			info_data->SetTime( time_corr );
+			info_data->SetSfp( febex_data->GetSfp() );
+			info_data->SetBoard( febex_data->GetBoard() );
+			info_data->SetCode( my_info_code );
+			QueueData( info_data );
+			info_data->Clear();
+
+		}
+
+		// Otherwise it is real data, so fill a FEBEX event
+		else {
+			
+			// Set this data and fill event to tree
+			// Also add the time offset when we do this
+			febex_data->SetTime( time_corr );
+			febex_data->SetQfloat( my_adc_data_float );
+			QueueData( febex_data );
+			
+		}
+
+	}
+
+	// missing something
+	else if( my_tm_stp != febex_data->GetTime() ) {
+		
+		std::cout << "Missing something in FEBEX data and new event occured" << std::endl;
+		std::cout << " Qint          = " << flag_febex_data0 << std::endl;
+		std::cout << " Qhalf         = " << flag_febex_data1 << std::endl;
+		std::cout << " Qfloat (low)  = " << flag_febex_data2 << std::endl;
+		std::cout << " Qfloat (high) = " << flag_febex_data3 << std::endl;
+		std::cout << " trace data    = " << flag_febex_trace << std::endl;
+
+	}
+
+	// This is normal, just not finished yet
+	else return;
+	
+	// Fill histograms
+	hfebex_hit[febex_data->GetSfp()][febex_data->GetBoard()]->Fill(
+		ctr_febex_hit[febex_data->GetSfp()][febex_data->GetBoard()],
+		febex_data->GetTime(), 1 );
+
+	// Count the hit, even if it's bad
+	ctr_febex_hit[febex_data->GetSfp()][febex_data->GetBoard()]++;
+	
+	// Assuming it did finish, in a good way or bad, clean up.
+	flag_febex_data0 = false;
+	flag_febex_data1 = false;
+	flag_febex_data2 = false;
+	flag_febex_data3 = false;
+	flag_febex_trace = false;
+	febex_data->ClearData();
+	
+	return;
+
+}
+
+void Converter::ProcessInfoData(){
+
+	// MIDAS info data format
+	my_sfp_id	= (word_0 >> 28) & 0x0003; // bits 28:29
+	my_board_id	= (word_0 >> 24) & 0x000F; // bits 24:27
+
+	my_info_field	= word_0 & 0x000FFFFF; // bits 0:19
+	my_info_code	= (word_0 >> 20) & 0x0000000F; // bits 20:23
+	my_tm_stp_lsb	= word_1 & 0x0FFFFFFF;  // bits 0:27
+
+	// HSB of FEBEX extended timestamp
+	if( my_info_code == set->GetTimestampCode() ) {
+		
+		my_tm_stp_hsb = my_info_field & 0x000FFFFF;
+
+	}
+	
+	// MSB of FEBEX extended timestamp
+	if( my_info_code == set->GetSyncCode() ) {
+		
+		// In FEBEX this would be the extended timestamp
+		my_tm_stp_msb = my_info_field & 0x000FFFFF;
+		my_tm_stp = ( my_tm_stp_hsb << 48 ) | ( my_tm_stp_msb << 28 ) | ( my_tm_stp_lsb & 0x0FFFFFFF );
+
+	}
+		
+	// Pause
+    if( my_info_code == set->GetPauseCode() ) {
+         
+		my_tm_stp_msb = my_info_field & 0x000FFFFF;
+		my_tm_stp = ( my_tm_stp_hsb << 48 ) | ( my_tm_stp_msb << 28 ) | ( my_tm_stp_lsb & 0x0FFFFFFF );
+		hfebex_pause[my_sfp_id][my_board_id]->Fill( ctr_febex_pause[my_sfp_id][my_board_id], my_tm_stp, 1 );
+		ctr_febex_pause[my_sfp_id][my_board_id]++;
+
+    }
+
+	// Resume
+	if( my_info_code == set->GetResumeCode() ) {
+         
+		my_tm_stp_msb = my_info_field & 0x000FFFFF;
+		my_tm_stp = ( my_tm_stp_hsb << 48 ) | ( my_tm_stp_msb << 28 ) | ( my_tm_stp_lsb & 0x0FFFFFFF );
+		hfebex_resume[my_sfp_id][my_board_id]->Fill( ctr_febex_resume[my_sfp_id][my_board_id], my_tm_stp, 1 );
+		ctr_febex_resume[my_sfp_id][my_board_id]++;
+
+    }
+
+	// Create an info event and fill the tree for external triggers and pause/resume
+	if( my_info_code == set->GetPauseCode() ||
+	    my_info_code == set->GetResumeCode() ) {
+
+		info_data->SetSfp( my_sfp_id );
+		info_data->SetBoard( my_board_id );
+		info_data->SetTime( my_tm_stp );
+		info_data->SetCode( my_info_code );
+		QueueData( info_data );
+		info_data->Clear();
+
+	}
+
+	return;
+	
+}
+
+// Common function called to process data in a block from file or DataSpy
+bool Converter::ProcessCurrentBlock( int nblock ) {
+	
+	// Decode the header and data, then process it
+	decoded.resize( 1 );
+	DecodeBlock( block_header, block_data, nblock, decoded[0] );
+	
+	return ProcessDecodedBlock( decoded[0] );
+
+}
+
+// Function to convert a block of data from DataSpy.
+// The block is decoded where it is, in the buffer owned by the caller,
+// so length must be the number of bytes that are really there.
+int Converter::ConvertBlock( const char *input_block, unsigned int length, int nblock ) {
+	
+	// Find the block size from the first one we get
+	if( flag_auto_block_size && block_size_file.empty() ) {
+		
+		unsigned int block_size = DetectBlockSize( input_block, length );
+		if( block_size ) SetBlockSize( block_size );
+		block_size_file = "DataSpy";
+		
+	}
+	
+	// A whole block can be used as it is
+	if( length >= DATA_BLOCK_SIZE ) {
+		
+		block_header = input_block;
+		block_data = input_block + HEADER_SIZE;
+		
+	}
+	
+	// Anything shorter is copied and padded with zeros, so we never
+	// read past the end of the caller's buffer
+	else {
+		
+		std::memset( block_header_buf, 0, HEADER_SIZE );
+		std::memset( block_data_buf.data(), 0, MAIN_SIZE );
+		std::memcpy( block_header_buf, input_block, std::min( length, (unsigned int)HEADER_SIZE ) );
+		if( length > HEADER_SIZE )
+			std::memcpy( block_data_buf.data(), input_block + HEADER_SIZE, length - HEADER_SIZE );
+		
+		block_header = block_header_buf;
+		block_data = block_data_buf.data();
+		
+	}
+	
+	// Process the data
+	ProcessCurrentBlock( nblock );
+	
+	// Don't hold on to the caller's buffer
+	block_header = block_header_buf;
+	block_data = block_data_buf.data();
+
+	return nblock+1;
+	
+}
+
+// Map the input file into memory so that blocks are decoded in place.
+// The offset must be a multiple of the page size, which any whole number
+// of blocks is.
+bool Converter::MapInputFile( int fd, unsigned long long offset, unsigned long long size ) {
+	
+	// Nothing to map for an empty file
+	if( size == 0 ) return false;
+	
+	void *addr = mmap( nullptr, size, PROT_READ, MAP_PRIVATE, fd, offset );
+	if( addr == MAP_FAILED ) return false;
+	
+	// We read the file from start to end, so tell the kernel to read ahead
+	madvise( addr, size, MADV_SEQUENTIAL );
+	
+	map_data = (char*)addr;
+	map_size = size;
+	
+	return true;
+	
+}
+
+// Unmap the input file and go back to our own block arrays
+void Converter::UnmapInputFile() {
+	
+	if( map_data ) munmap( map_data, map_size );
+	
+	map_data = nullptr;
+	map_size = 0;
+	block_header = block_header_buf;
+	block_data = block_data_buf.data();
+	
+	return;
+	
+}
+
+// Add a decoded block to the block index. This keeps its own copy of the
+// extended timestamp, so that it doesn't matter if the blocks are being
+// converted as well, or just indexed.
+void Converter::IndexDecodedBlock( DecodedBlock &blk ){
+	
+	BlockIndexEntry entry;
+	entry.offset = (ULong64_t)blk.nblock * DATA_BLOCK_SIZE;
+	entry.header_sequence = blk.header_sequence;
+	entry.flags = 0;
+	entry.time_first = 0;
+	entry.time_last = 0;
+	entry.tm_stp_msb = idx_tm_stp_msb;
+	entry.tm_stp_hsb = idx_tm_stp_hsb;
+	
+	if( blk.flag_header && blk.flag_terminator )
+		entry.flags |= BlockIndex::BLOCK_GOOD;
+	
+	// Count hits for each SFP and board
+	unsigned int nboards = set->GetNumberOfFebexBoards();
+	std::vector<UInt_t> hits( set->GetNumberOfFebexSfps() * nboards, 0 );
+	
+	// A trace following the ADC data of the same channel is the same hit
+	unsigned int last_chan = 0xFFFF;
+	unsigned long last_lsb = 0;
+	
+	for( unsigned int i = 0; i < blk.words.size(); i++ ) {
+		
+		UInt_t w0 = (blk.words[i] & 0xFFFFFFFF00000000) >> 32;
+		UInt_t w1 = (blk.words[i] & 0x00000000FFFFFFFF);
+		unsigned char type = ( w0 >> 30 ) & 0x3;
+		
+		// Information data can change the extended timestamp
+		if( type == 0x2 ) {
+			
+			unsigned int info_field = w0 & 0x000FFFFF;
+			unsigned char info_code = (w0 >> 20) & 0x0000000F;
+			
+			if( info_code == set->GetTimestampCode() )
+				idx_tm_stp_hsb = info_field;
+			
+			else if( info_code == set->GetSyncCode() ||
+					 info_code == set->GetPauseCode() ||
+					 info_code == set->GetResumeCode() ) {
+				
+				idx_tm_stp_msb = info_field;
+				
+				// No hits yet, so this block doesn't need the one before
+				if( !( entry.flags & BlockIndex::BLOCK_HITS ) )
+					entry.flags |= BlockIndex::BLOCK_SYNC;
+				
+			}
+			
+		}
+		
+		// ADC data or trace header
+		else if( type == 0x3 || type == 0x1 ) {
+			
+			unsigned int ADCchanIdent = (w0 >> 16) & 0x0FFF;
+			unsigned char sfp_id = (ADCchanIdent >> 10) & 0x0003;
+			unsigned char board_id = (ADCchanIdent >> 6) & 0x000F;
+			unsigned char data_id = (ADCchanIdent >> 4) & 0x0003;
+			unsigned int chan = ADCchanIdent & 0x0FCF; // without data_id
+			
+			if( sfp_id >= set->GetNumberOfFebexSfps() ||
+			    board_id >= nboards ||
+			    ( ADCchanIdent & 0x000F ) >= set->GetNumberOfFebexChannels() )
+				continue;
+			
+			unsigned long tm_stp_lsb = w1 & 0x0FFFFFFF;
+			ULong64_t tm_stp = ( idx_tm_stp_msb << 28 ) | tm_stp_lsb;
+			
+			// New hit for the first data item or a trace on its own
+			bool flag_hit = false;
+			if( type == 0x3 && data_id == 0 ) {
+				
+				flag_hit = true;
+				last_chan = chan;
+				last_lsb = tm_stp_lsb;
+				
+			}
+			
+			else if( type == 0x1 && ( chan != last_chan || tm_stp_lsb != last_lsb ) )
+				flag_hit = true;
+			
+			if( !flag_hit ) continue;
+			
+			if( !( entry.flags & BlockIndex::BLOCK_HITS ) || tm_stp < entry.time_first )
+				entry.time_first = tm_stp;
+			if( !( entry.flags & BlockIndex::BLOCK_HITS ) || tm_stp > entry.time_last )
+				entry.time_last = tm_stp;
+			
+			entry.flags |= BlockIndex::BLOCK_HITS;
+			hits[ sfp_id * nboards + board_id ]++;
+			
+		}
+		
+	}
+	
+	block_index->AddBlock( entry, hits );
+	
+	return;
+	
+}
+
+// Check if a block has hits from any of the selected boards
+bool Converter::IsBlockSelected( unsigned long nblock ){
+	
+	if( board_select.empty() ) return true;
+	if( nblock >= block_index->GetNumberOfBlocks() ) return true;
+	
+	for( unsigned int i = 0; i < board_select.size(); ++i )
+		if( block_index->GetHits( nblock, board_select[i].first, board_select[i].second ) )
+			return true;
+	
+	return false;
+	
+}
+
+// Start converting from a block that doesn't follow the previous one.
+// The extended timestamp comes from the index and any unfinished hit
+// from the previous block is thrown away.
+void Converter::JumpToBlock( unsigned long nblock ){
+	
+	BlockIndexEntry &entry = block_index->GetEntry( nblock );
+	my_tm_stp_msb = entry.tm_stp_msb;
+	my_tm_stp_hsb = entry.tm_stp_hsb;
+	
+	flag_febex_data0 = false;
+	flag_febex_data1 = false;
+	flag_febex_data2 = false;
+	flag_febex_data3 = false;
+	flag_febex_trace = false;
+	if( febex_data ) febex_data->ClearData();
+	
+	return;
+	
+}
+
+// Read the block index from the sidecar file, if it is still up to date,
+// or make it from the data file if not. A new one is only written to the
+// sidecar file if we were asked to with SetWriteIndex.
+bool Converter::LoadBlockIndex( std::string input_file_name ){
+	
+	struct stat input_stat;
+	if( stat( input_file_name.data(), &input_stat ) != 0 ||
+	    !S_ISREG( input_stat.st_mode ) )
+		return false;
+	
+	// The index is only good for the same block size
+	FindBlockSize( input_file_name );
+	
+	// Already have it
+	if( block_index && block_index_file == input_file_name &&
+	    block_index->IsValidFor( input_stat.st_size, input_stat.st_mtime ) )
+		return true;
+	
+	block_index = std::make_shared<BlockIndex>( set->GetNumberOfFebexSfps(),
+											   set->GetNumberOfFebexBoards() );
+	
+	if( block_index->ReadIndex( BlockIndex::GetIndexFileName( input_file_name ) ) &&
+	    block_index->GetBlockSize() == DATA_BLOCK_SIZE &&
+	    block_index->IsValidFor( input_stat.st_size, input_stat.st_mtime ) ) {
+		
+		block_index_file = input_file_name;
+		return true;
+		
+	}
+	
+	return BuildBlockIndex( input_file_name );
+	
+}
+
+// Go through the whole file to make the block index, without converting.
+// The traces are skipped and there is no MWD, so this is quick.
+bool Converter::BuildBlockIndex( std::string input_file_name ){
+	
+	flag_index_only = true;
+	int nblocks = ConvertFile( input_file_name );
+	flag_index_only = false;
+	
+	return nblocks >= 0 && block_index_file == input_file_name;
+	
+}
+
+// Convert only the blocks with hits between tmin and tmax, using the
+// block index to find them. Hits outside the window from the same blocks
+// are also converted.
+int Converter::ConvertTimeWindow( std::string input_file_name,
+								  ULong64_t tmin, ULong64_t tmax ){
+	
+	if( !LoadBlockIndex( input_file_name ) ) {
+		
+		std::cout << "Cannot make a block index for " << input_file_name << std::endl;
+		return -1;
+		
+	}
+	
+	unsigned long first_block, last_block;
+	if( !block_index->FindTimeWindow( tmin, tmax, first_block, last_block ) ) {
+		
+		std::cout << "No data between " << tmin << " and " << tmax;
+		std::cout << " in " << input_file_name << std::endl;
+		return block_index->GetNumberOfBlocks();
+		
+	}
+	
+	return ConvertFile( input_file_name, first_block, last_block );
+	
+}
 
+// Function to run the conversion for a single file.
+// Only complete blocks from start_block onwards are read, so a file that
+// is still being written can be followed by passing the return value back
+// in as start_block on the next call. The timestamp MSB and HSB are kept
+// between calls, so the hits in new blocks get the right extended time.
+// A whole file is indexed as it is converted if we were asked to write the
+// index next to it with SetWriteIndex, see BlockIndex.
+int Converter::ConvertFile( std::string input_file_name,
+							 unsigned long start_block,
+							 long end_block ) {
+	
+	// Regular files are read ahead or mapped into memory, anything else is read as a stream
+	struct stat input_stat;
+	if( stat( input_file_name.data(), &input_stat ) != 0 ){
+		
+		std::cout << "Cannot open " << input_file_name << std::endl;
+		return -1;
+		
 	}
+	
+	bool flag_size_known = S_ISREG( input_stat.st_mode );
+	
+	// Compressed files are uncompressed as we go, like a stream
+	CompressedFile::format_t compression = CompressedFile::FORMAT_NONE;
+	if( flag_size_known ) compression = CompressedFile::GetFormat( input_file_name );
+	if( compression != CompressedFile::FORMAT_NONE ) flag_size_known = false;
+	
+	unsigned long long FILE_SIZE = 0;
+	if( flag_size_known ) FILE_SIZE = input_stat.st_size;
+	
+	// Blocks are read ahead on another thread, unless we map the file
+	bool flag_read_ahead = compression == CompressedFile::FORMAT_NONE &&
+		( !flag_size_known || set->GetReadAheadBlocks() > 0 );
+	
+	// Block size from the data, if we're not told it
+	FindBlockSize( input_file_name );
+	
+	// Carry on after the checkpoint of an interrupted conversion
+	if( flag_resume && input_file_name == resume_input_file && resume_block > start_block )
+		start_block = resume_block;
+	flag_resume = false;
+	
+	// Checkpoints only make sense when going through the whole file
+	unsigned int checkpoint_blocks = set->GetCheckpointBlocks();
+	bool flag_checkpoint = checkpoint_blocks > 0 && !checkpoint_file.empty() &&
+		!flag_index_only && board_select.empty() && end_block < 0;
+	unsigned long ncheckpoint = start_block;
 
+	// Calculate the number of complete blocks in the file.
+	// A partial block at the end is picked up on the next call.
+	unsigned long BLOCKS_NUM = FILE_SIZE / DATA_BLOCK_SIZE;
+	
+	// Last block that we need to look at
+	unsigned long last_block = BLOCKS_NUM;
+	if( end_block >= 0 && (unsigned long)end_block < last_block )
+		last_block = end_block + 1;
+	
+	// Nothing new in this file since last time
+	if( flag_size_known && start_block >= last_block )
+		return BLOCKS_NUM;
+	
+	// We need the block index to pick out some boards
+	if( flag_size_known && !flag_index_only && !board_select.empty() )
+		LoadBlockIndex( input_file_name );
+	
+	// Use the block index if it's up to date, to jump between blocks
+	bool flag_use_index = !flag_index_only && block_index &&
+		block_index_file == input_file_name &&
+		block_index->IsValidFor( FILE_SIZE, input_stat.st_mtime );
+	
+	// Otherwise make a new index if we go through the whole file, because
+	// we need it now or because we were asked to write one
+	bool flag_make_index = ( flag_index_only || flag_write_index ) &&
+		flag_size_known && !flag_use_index &&
+		start_block == 0 && last_block == BLOCKS_NUM && board_select.empty();
+	
+	if( flag_make_index ) {
+		
+		block_index = std::make_shared<BlockIndex>( set->GetNumberOfFebexSfps(),
+												   set->GetNumberOfFebexBoards() );
+		block_index->SetBlockSize( DATA_BLOCK_SIZE );
+		block_index->SetInputFile( FILE_SIZE, input_stat.st_mtime );
+		block_index_file.clear();
+		idx_tm_stp_msb = 0;
+		idx_tm_stp_hsb = 0;
+		
+	}
+	
+	// Blocks are decoded in batches, in parallel if we have threads
+	unsigned int batch_size = nthreads * BLOCKS_PER_THREAD;
+	if( nthreads <= 1 ) batch_size = 1;
+	
+	// Map only the blocks that we want to convert
+	if( flag_size_known && !flag_read_ahead ){
+		
+		int fd = open( input_file_name.data(), O_RDONLY );
+		if( fd < 0 ){
+			
+			std::cout << "Cannot open " << input_file_name << std::endl;
+			return -1;
+			
+		}
+		
+		// The mapping stays valid after the file descriptor is closed
+		MapInputFile( fd, (unsigned long long)start_block * DATA_BLOCK_SIZE,
+					 (unsigned long long)( last_block - start_block ) * DATA_BLOCK_SIZE );
+		close( fd );
+		
+	}
+	
+	// Start uncompressing, then skip to the start block
+	CompressedFile compressed_file;
+	if( compression != CompressedFile::FORMAT_NONE ) {
+		
+		if( !compressed_file.Open( input_file_name ) ) {
+			
+			std::cout << "Cannot open " << input_file_name << std::endl;
+			return -1;
+			
+		}
+		
+		compressed_file.Ignore( (unsigned long long)start_block * DATA_BLOCK_SIZE );
+		
+	}
+	
+	// Or read the blocks ahead of decoding them, with enough buffers
+	// for a whole batch plus the ones in flight
+	BlockReader block_reader;
+	if( flag_read_ahead || ( !map_data && compression == CompressedFile::FORMAT_NONE ) ) {
+		
+		// Just the blocks picked out by the index
+		std::vector<unsigned long> block_list;
+		if( flag_use_index ) {
+			
+			for( unsigned long i = start_block; i < last_block; ++i )
+				if( IsBlockSelected( i ) ) block_list.push_back( i );
+			
+		}
+		
+		unsigned int nbuffers = batch_size + std::max( 2u, set->GetReadAheadBlocks() );
+		if( !block_reader.Open( input_file_name, DATA_BLOCK_SIZE, nbuffers, start_block,
+							   flag_size_known ? last_block : 0, block_list ) ){
+			
+			std::cout << "Cannot open " << input_file_name << std::endl;
+			return -1;
+			
+		}
+		
+		flag_read_ahead = true;
+		
+	}
 
-	return;
-
-}
+	// Conversion starting
+	if( flag_index_only ) std::cout << "Indexing file: " << input_file_name;
+	else std::cout << "Converting file: " << input_file_name;
+	std::cout << " from block " << start_block << std::endl;
+	
+	//a sanity check for file size...
+	//QQQ: add more strict test?
+	if( FILE_SIZE % DATA_BLOCK_SIZE != 0 ){
+		
+		std::cout << " *WARNING* " << __PRETTY_FUNCTION__;
+		std::cout << "\tMissing data blocks?" << std::endl;
 
-void Converter::FinishFebexData(){
+	}
 	
-	// Timestamp with offset
-	unsigned long long time_corr;
+	if( flag_size_known ){
+		
+		sslogs << "\t File size = " << FILE_SIZE << std::endl;
+		sslogs << "\tBlock size = " << DATA_BLOCK_SIZE << std::endl;
+		sslogs << "\t  N blocks = " << BLOCKS_NUM << std::endl;
+		
+	}
 	
-	// Got all items in fast readout mode or trace only mode
-	if( ( flag_febex_data0 && flag_febex_data1 &&
-	    flag_febex_data2 && flag_febex_data3 ) || flag_febex_trace ){
+	else {
+		
+		if( compression != CompressedFile::FORMAT_NONE )
+			sslogs << "\t File size = unknown, " << CompressedFile::GetFormatName( compression ) << " compressed" << std::endl;
+		else
+			sslogs << "\t File size = unknown, reading until end of stream" << std::endl;
+		sslogs << "\tBlock size = " << DATA_BLOCK_SIZE << std::endl;
+		
+	}
 
-		// Add the time offset to this channel
-		time_corr  = febex_data->GetTime();
-		time_corr += cal->FebexTime( febex_data->GetSfp(), febex_data->GetBoard(), febex_data->GetChannel() );
+	std::cout << sslogs.str() << std::endl;
+	sslogs.str( std::string() ); // clean up
+	
 
-		// Combine the two halfs of the floating point ADC energy
-		my_adc_data_float = ( my_adc_data_hsb << 16 ) | ( my_adc_data_lsb & 0xFFFF );
+	// Data format: http://npg.dl.ac.uk/documents/edoc504/edoc504.html
+	// The information is split into 2 words of 32 bits (4 byte).
+	// We will collect the data in 64 bit words and split later
+	
+	// Blocks are decoded in batches
+	batch_blocks.resize( batch_size );
+	decoded.resize( batch_size );
+	if( compression != CompressedFile::FORMAT_NONE )
+		batch_buffer.resize( (unsigned long)batch_size * DATA_BLOCK_SIZE );
+	
+	// Loop over all the blocks.
+	unsigned long nblock = start_block;		// next block to read
+	unsigned long nnext = start_block;		// block that follows the last one
+	unsigned long ndropped = start_block;
+	bool flag_stop = false;
+	
+	// When using the index, always take the timestamp from it at the start
+	if( flag_use_index ) nnext = (unsigned long)-1;
+	
+	while( !flag_stop && ( nblock < last_block || !flag_size_known ) ){
 		
-		// Check if this is actually just a timestamp or info like event
-		flag_febex_info = false;
-		if( febex_data->GetSfp()     == set->GetPulserSfp()     &&
-		    febex_data->GetBoard()   == set->GetPulserBoard()   &&
-		    febex_data->GetChannel() == set->GetPulserChannel() ){
+		// Collect the next batch of blocks
+		unsigned int nbatch;
+		for( nbatch = 0; nbatch < batch_size; ++nbatch, ++nblock ){
 			
-			flag_febex_info = true;
-			my_info_code = 20; // Pulser is always 20 (defined here)
-			hfebex_ext->Fill( ctr_febex_ext, febex_data->GetTime(), 1 );
-			ctr_febex_ext++;
+			// Skip blocks without the boards we want
+			if( flag_use_index )
+				while( nblock < last_block && !IsBlockSelected( nblock ) )
+					nblock++;
+			
+			if( flag_size_known && nblock >= last_block ) break;
+			if( !flag_size_known && end_block >= 0 && (long)nblock > end_block ) break;
+			
+			// Point directly at the block in the mapped file
+			if( map_data )
+				batch_blocks[nbatch] = map_data + ( nblock - start_block ) * DATA_BLOCK_SIZE;
+			
+			// Or uncompress it into our buffer
+			else if( compression != CompressedFile::FORMAT_NONE ) {
+				
+				batch_blocks[nbatch] = batch_buffer.data() + (unsigned long)nbatch * DATA_BLOCK_SIZE;
+				if( compressed_file.Read( (char*)batch_blocks[nbatch], DATA_BLOCK_SIZE ) != DATA_BLOCK_SIZE )
+					break;
+				
+			}
+			
+			// Otherwise it's waiting for us in the read ahead buffers
+			else {
+				
+				batch_blocks[nbatch] = block_reader.Next( nblock );
+				
+				// End of a stream of unknown length
+				if( !batch_blocks[nbatch] ) break;
+				
+			}
+			
+			decoded[nbatch].nblock = nblock;
+			
+		}
+		
+		// Nothing left to read
+		if( nbatch == 0 ) break;
+		
+		// Decode all blocks in the batch
+		DecodeBatch( nbatch );
+		
+		// Then process them in order
+		for( unsigned int i = 0; i < nbatch; ++i ){
+			
+			unsigned long iblock = decoded[i].nblock;
+
+			// Take one block each time and analyze it.
+			unsigned long nmapped = iblock - start_block;
+			if( flag_size_known && ( nmapped % 200 == 0 || iblock+1 == last_block ) ) {
+				
+				// Percent complete
+				float percent = (float)(nmapped+1)*100.0/(float)(last_block-start_block);
+				
+				// Progress bar in GUI
+				if( _prog_ ){
+					
+					prog->SetPosition( percent );
+					gSystem->ProcessEvents();
 
+				}
+				
+				// Progress bar in terminal
+				if( job_name.size() ) PrintJobProgress( "converting", percent );
+				else {
+					
+					std::cout << " " << std::setw(8) << std::setprecision(4);
+					std::cout << percent << "%\r";
+					std::cout.flush();
+					
+				}
+				
+			}
+
+			// Just add it to the index
+			if( flag_index_only ) {
+				
+				IndexDecodedBlock( decoded[i] );
+				continue;
+				
+			}
+			
+			// Get the timestamp from the index if we skipped some blocks
+			if( flag_use_index && iblock != nnext ) JumpToBlock( iblock );
+			nnext = iblock + 1;
+			
+			// Process current block. If it's the end, stop.
+			if( !ProcessDecodedBlock( decoded[i] ) ) {
+				
+				flag_stop = true;
+				break;
+				
+			}
+			
+			if( flag_make_index ) IndexDecodedBlock( decoded[i] );
+			
 		}
 		
-		else if( febex_data->GetSfp()     == set->GetEBISSfp()     &&
-				 febex_data->GetBoard()   == set->GetEBISBoard()   &&
-				 febex_data->GetChannel() == set->GetEBISChannel() ){
+		// Give the buffers back to be read in to again
+		if( flag_read_ahead )
+			for( unsigned int i = 0; i < nbatch; ++i )
+				block_reader.Release();
+		
+		// Save where we are, but not with a hit half way through
+		if( flag_checkpoint && !flag_stop && nblock - ncheckpoint >= checkpoint_blocks &&
+		    !flag_febex_data0 && !flag_febex_data1 && !flag_febex_data2 && !flag_febex_data3 ) {
 			
-			flag_febex_info = true;
-			my_info_code = 21; // EBIS is always 21 (defined here)
+			WriteCheckpoint( input_file_name, nblock );
+			ncheckpoint = nblock;
 			
 		}
 		
-		else if( febex_data->GetSfp()     == set->GetT1Sfp()     &&
-				 febex_data->GetBoard()   == set->GetT1Board()   &&
-				 febex_data->GetChannel() == set->GetT1Channel() ){
+		// Drop the pages we have finished with from the mapping
+		if( map_data && nblock - ndropped >= 200 ) {
 			
-			flag_febex_info = true;
-			my_info_code = 22; // T1 is always 22 (defined here)
+			madvise( map_data + ( ndropped - start_block ) * DATA_BLOCK_SIZE,
+					( nblock - ndropped ) * DATA_BLOCK_SIZE, MADV_DONTNEED );
+			ndropped = nblock;
 			
 		}
+		
+	} // loop - nblock < last_block
+	
+	if( map_data ) UnmapInputFile();
+	else if( compression != CompressedFile::FORMAT_NONE ) compressed_file.Close();
+	else block_reader.Close();
+	
+	if( !flag_size_known ) BLOCKS_NUM = nblock;
+	
+	// Keep the index if we got through the whole file, and write it if asked
+	if( flag_make_index && block_index->IsComplete() ) {
+		
+		if( flag_write_index )
+			block_index->WriteIndex( BlockIndex::GetIndexFileName( input_file_name ) );
+		block_index_file = input_file_name;
+		
+	}
 
-		// If this is a timestamp, fill an info event
-		if( flag_febex_info ) {
-				
-			info_data->SetTime( time_corr );
-			info_data->SetSfp( febex_data->GetSfp() );
-			info_data->SetBoard( febex_data->GetBoard() );
-			info_data->SetCode( my_info_code );
-			data_packet->SetData( info_data );
-			output_tree->Fill();
-			info_data->Clear();
+	return BLOCKS_NUM;
+	
+}
 
+// Save the state of the conversion, so that it can carry on from the next
+// block if it's interrupted. The output file and the sorted chunks are
+// brought up to date first, then the checkpoint replaces the last one.
+void Converter::WriteCheckpoint( std::string input_file_name, unsigned long nblock ){
+	
+	// Hits waiting in the reorder buffer of the streaming sort, or in the
+	// sort queues, are saved as they are, with a new file for each checkpoint.
+	// The queues stay in memory, so a chunk is only written when they're full.
+	std::string hits_file = checkpoint_file + "_" + std::to_string( nblock ) + ".hits";
+	std::ofstream hits( hits_file, std::ios::out|std::ios::binary|std::ios::trunc );
+	if( set->GetSortWindow() > 0 ) {
+		
+		for( unsigned int i = 0; i < reorder_buffer.size(); ++i ) {
+			
+			hits.write( (char*)&reorder_buffer[i].seq, sizeof(reorder_buffer[i].seq) );
+			hits.write( (char*)&reorder_buffer[i].hit, sizeof(SortHit) );
+			hits.write( (char*)reorder_buffer[i].samples.data(),
+					   reorder_buffer[i].samples.size() * sizeof(unsigned short) );
+			
 		}
-
-		// Otherwise it is real data, so fill a FEBEX event
-		else {
+		
+	}
+	
+	else {
+		
+		for( unsigned int q = 0; q < sort_queue.size(); ++q ) {
 			
-			// Set this data and fill event to tree
-			// Also add the time offset when we do this
-			febex_data->SetTime( time_corr );
-			febex_data->SetQfloat( my_adc_data_float );
-			data_packet->SetData( febex_data );
-			output_tree->Fill();
+			for( unsigned int i = 0; i < sort_queue[q].size(); ++i ) {
+				
+				const SortHit &hit = sort_queue[q][i];
+				hits.write( (char*)&q, sizeof(q) );
+				hits.write( (char*)&hit, sizeof(SortHit) );
+				hits.write( (char*)( sort_samples[q].data() + hit.trace_start ),
+						   hit.trace_length * sizeof(unsigned short) );
+				
+			}
 			
 		}
-
+		
 	}
-
-	// missing something
-	else if( my_tm_stp != febex_data->GetTime() ) {
+	
+	hits.close();
+	if( hits.fail() ) {
+		
+		std::cout << "Cannot write " << hits_file << ", no checkpoint" << std::endl;
+		std::remove( hits_file.data() );
+		return;
+		
+	}
+	
+	if( set->GetSortWindow() > 0 ) FlushSamples();
+	
+	// Spectra and trees in the output file
+	UpdateHists();
+	output_file->Write( 0, TObject::kWriteDelete );
+	
+	// Where we are
+	TEnv ckpt;
+	ckpt.SetValue( "InputFile", input_file_name.data() );
+	ckpt.SetValue( "NextBlock", std::to_string( nblock ).data() );
+	ckpt.SetValue( "TimestampMSB", std::to_string( my_tm_stp_msb ).data() );
+	ckpt.SetValue( "TimestampHSB", std::to_string( my_tm_stp_hsb ).data() );
+	ckpt.SetValue( "SortWindow", set->GetSortWindow() );
+	ckpt.SetValue( "FlatHitOutput", (int)set->IsFlatOutput() );
+	ckpt.SetValue( "FebexSfps", (int)set->GetNumberOfFebexSfps() );
+	ckpt.SetValue( "FebexBoards", (int)set->GetNumberOfFebexBoards() );
+	ckpt.SetValue( "SortedEntries", std::to_string( sorted_tree->GetEntries() ).data() );
+	
+	// Counters for each board
+	for( unsigned int i = 0; i < set->GetNumberOfFebexSfps(); ++i ) {
+		
+		std::string hit, pause, resume;
+		for( unsigned int j = 0; j < set->GetNumberOfFebexBoards(); ++j ) {
+			
+			hit += std::to_string( ctr_febex_hit[i][j] ) + " ";
+			pause += std::to_string( ctr_febex_pause[i][j] ) + " ";
+			resume += std::to_string( ctr_febex_resume[i][j] ) + " ";
+			
+		}
+		
+		ckpt.SetValue( ( "FebexHits." + std::to_string(i) ).data(), hit.data() );
+		ckpt.SetValue( ( "FebexPause." + std::to_string(i) ).data(), pause.data() );
+		ckpt.SetValue( ( "FebexResume." + std::to_string(i) ).data(), resume.data() );
+		
+	}
+	ckpt.SetValue( "FebexExtTrigger", std::to_string( ctr_febex_ext ).data() );
+	
+	// Hits still to be sorted
+	std::string chunks;
+	for( unsigned int i = 0; i < sort_chunks.size(); ++i )
+		chunks += sort_chunks[i] + " ";
+	ckpt.SetValue( "SortChunks", chunks.data() );
+	ckpt.SetValue( "SortChunkHits", std::to_string( sort_chunk_hits ).data() );
+	ckpt.SetValue( "WaitingHits", hits_file.data() );
+	ckpt.SetValue( "ReorderSeq", std::to_string( reorder_seq ).data() );
+	ckpt.SetValue( "ReorderNewest", std::to_string( reorder_newest ).data() );
+	ckpt.SetValue( "ReorderLast", std::to_string( reorder_last ).data() );
+	ckpt.SetValue( "ReorderFilled", std::to_string( ctr_reorder_fill ).data() );
+	ckpt.SetValue( "ReorderLate", std::to_string( ctr_reorder_late ).data() );
+	
+	// The old reorder hits are finished with once the new checkpoint is in place
+	TEnv old_ckpt;
+	std::string old_hits_file;
+	if( old_ckpt.ReadFile( checkpoint_file.data(), kEnvLocal ) == 0 )
+		old_hits_file = old_ckpt.GetValue( "WaitingHits", "" );
+	
+	// Write a new file and swap it in, so there's always a good checkpoint
+	std::string new_file = checkpoint_file + ".new";
+	ckpt.WriteFile( new_file.data() );
+	if( std::rename( new_file.data(), checkpoint_file.data() ) != 0 ) {
+		
+		std::cout << "Cannot write " << checkpoint_file << std::endl;
+		return;
 		
-		std::cout << "Missing something in FEBEX data and new event occured" << std::endl;
-		std::cout << " Qint          = " << flag_febex_data0 << std::endl;
-		std::cout << " Qhalf         = " << flag_febex_data1 << std::endl;
-		std::cout << " Qfloat (low)  = " << flag_febex_data2 << std::endl;
-		std::cout << " Qfloat (high) = " << flag_febex_data3 << std::endl;
-		std::cout << " trace data    = " << flag_febex_trace << std::endl;
-
 	}
+	
+	if( old_hits_file.size() && old_hits_file != hits_file )
+		std::remove( old_hits_file.data() );
+	
+	return;
+	
+}
 
-	// This is normal, just not finished yet
-	else return;
+// Remove the checkpoint and anything that only it was using
+void Converter::RemoveCheckpoint(){
 	
-	// Fill histograms
-	hfebex_hit[febex_data->GetSfp()][febex_data->GetBoard()]->Fill(
-		ctr_febex_hit[febex_data->GetSfp()][febex_data->GetBoard()],
-		febex_data->GetTime(), 1 );
+	if( checkpoint_file.empty() ) return;
+	
+	TEnv ckpt;
+	if( ckpt.ReadFile( checkpoint_file.data(), kEnvLocal ) == 0 ) {
+		
+		// Chunks that are still being used by the sort are kept
+		std::stringstream ss( ckpt.GetValue( "SortChunks", "" ) );
+		std::string name;
+		while( ss >> name )
+			if( std::find( sort_chunks.begin(), sort_chunks.end(), name ) == sort_chunks.end() )
+				std::remove( name.data() );
+		
+		name = ckpt.GetValue( "WaitingHits", "" );
+		if( name.size() ) std::remove( name.data() );
+		
+	}
+	
+	std::remove( checkpoint_file.data() );
+	
+	return;
+	
+}
 
-	// Count the hit, even if it's bad
-	ctr_febex_hit[febex_data->GetSfp()][febex_data->GetBoard()]++;
+// Add a FEBEX hit to the queue for its board
+void Converter::QueueData( std::shared_ptr<FebexData> data ){
+	
+	unsigned int q = GetQueueIndex( data->GetSfp(), data->GetBoard() );
+	
+	SortHit hit;
+	hit.time = data->GetTime();
+	hit.energy = data->GetEnergy();
+	hit.Qfloat = data->GetQfloat();
+	hit.Qhalf = data->GetQhalf();
+	hit.Qint = data->GetQint();
+	hit.sfp = data->GetSfp();
+	hit.board = data->GetBoard();
+	hit.ch = data->GetChannel();
+	hit.code = 0;
+	hit.flags = 0;
+	if( data->IsOverThreshold() ) hit.flags |= SortHit::HIT_THRES;
+	if( data->IsVeto() ) hit.flags |= SortHit::HIT_VETO;
+	if( data->IsFail() ) hit.flags |= SortHit::HIT_FAIL;
+	
+	// Keep the samples in the store for this queue
+	hit.trace_start = sort_samples[q].size();
+	hit.trace_length = data->GetTraceLength();
+	// Streaming sort, if we have a window
+	if( set->GetSortWindow() > 0 ) {
+		
+		ReorderHit rhit;
+		rhit.hit = hit;
+		rhit.samples.resize( hit.trace_length );
+		for( unsigned int i = 0; i < hit.trace_length; ++i )
+			rhit.samples[i] = data->GetSample(i);
+		
+		ReorderData( rhit );
+		return;
+		
+	}
 	
-	// Assuming it did finish, in a good way or bad, clean up.
-	flag_febex_data0 = false;
-	flag_febex_data1 = false;
-	flag_febex_data2 = false;
-	flag_febex_data3 = false;
-	flag_febex_trace = false;
-	febex_data->ClearData();
+	for( unsigned int i = 0; i < hit.trace_length; ++i )
+		sort_samples[q].push_back( data->GetSample(i) );
+	
+	sort_queue[q].push_back( hit );
+	
+	// Write to disk if we're using too much memory
+	sort_bytes += sizeof(SortHit) + hit.trace_length * sizeof(unsigned short);
+	if( sort_bytes >= set->GetSortMemory() ) SpillQueues();
 	
 	return;
-
+	
 }
 
-void Converter::ProcessInfoData(){
-
-	// MIDAS info data format
-	my_sfp_id	= (word_0 >> 28) & 0x0003; // bits 28:29
-	my_board_id	= (word_0 >> 24) & 0x000F; // bits 24:27
-
-	my_info_field	= word_0 & 0x000FFFFF; // bits 0:19
-	my_info_code	= (word_0 >> 20) & 0x0000000F; // bits 20:23
-	my_tm_stp_lsb	= word_1 & 0x0FFFFFFF;  // bits 0:27
-
-	// HSB of FEBEX extended timestamp
-	if( my_info_code == set->GetTimestampCode() ) {
+// Add an info hit to the queue for its board
+void Converter::QueueData( std::shared_ptr<InfoData> data ){
+	
+	unsigned int q = GetQueueIndex( data->GetSfp(), data->GetBoard() );
+	
+	SortHit hit;
+	hit.time = data->GetTime();
+	hit.trace_start = 0;
+	hit.energy = 0;
+	hit.Qfloat = 0;
+	hit.Qhalf = 0;
+	hit.Qint = 0;
+	hit.trace_length = 0;
+	hit.sfp = data->GetSfp();
+	hit.board = data->GetBoard();
+	hit.ch = 0;
+	hit.code = data->GetCode();
+	hit.flags = SortHit::HIT_INFO;
+	
+	// Streaming sort, if we have a window
+	if( set->GetSortWindow() > 0 ) {
 		
-		my_tm_stp_hsb = my_info_field & 0x000FFFFF;
+		ReorderHit rhit;
+		rhit.hit = hit;
+		ReorderData( rhit );
+		return;
+		
+	}
+	
+	sort_queue[q].push_back( hit );
+	
+	// Write to disk if we're using too much memory
+	sort_bytes += sizeof(SortHit);
+	if( sort_bytes >= set->GetSortMemory() ) SpillQueues();
+	
+	return;
+	
+}
 
+// Fill a sorted hit back in to the output tree
+void Converter::FillSortedData( const SortHit &hit, const unsigned short *samples ){
+	
+	// The last lot of hits were already taken by SortTree
+	if( flag_reset_sorted ) ResetSortedTree();
+	
+	// Flat output, with the trace added to the sample array
+	if( sample_tree ) {
+		
+		flat_hit = hit;
+		flat_hit.trace_start = flat_sample_pos;
+		for( unsigned short i = 0; i < hit.trace_length; ++i ) {
+			
+			flat_samples[flat_nsamples++] = samples[i];
+			if( flat_nsamples == SortHit::samples_per_entry ) {
+				
+				sample_tree->Fill();
+				flat_nsamples = 0;
+				
+			}
+			
+		}
+		flat_sample_pos += hit.trace_length;
+		
 	}
 	
-	// MSB of FEBEX extended timestamp
-	if( my_info_code == set->GetSyncCode() ) {
+	else if( hit.flags & SortHit::HIT_INFO ) {
+		
+		sort_info->SetTime( hit.time );
+		sort_info->SetSfp( hit.sfp );
+		sort_info->SetBoard( hit.board );
+		sort_info->SetCode( hit.code );
+		data_packet->SetData( sort_info );
 		
-		// In FEBEX this would be the extended timestamp
-		my_tm_stp_msb = my_info_field & 0x000FFFFF;
-		my_tm_stp = ( my_tm_stp_hsb << 48 ) | ( my_tm_stp_msb << 28 ) | ( my_tm_stp_lsb & 0x0FFFFFFF );
-
 	}
+	
+	else {
+		
+		sort_febex->SetTime( hit.time );
+		sort_febex->SetEnergy( hit.energy );
+		sort_febex->SetQfloat( hit.Qfloat );
+		sort_febex->SetQhalf( hit.Qhalf );
+		sort_febex->SetQint( hit.Qint );
+		sort_febex->SetSfp( hit.sfp );
+		sort_febex->SetBoard( hit.board );
+		sort_febex->SetChannel( hit.ch );
+		sort_febex->SetThreshold( hit.flags & SortHit::HIT_THRES );
+		sort_febex->SetVeto( hit.flags & SortHit::HIT_VETO );
+		sort_febex->SetFail( hit.flags & SortHit::HIT_FAIL );
+		sort_febex->SetTrace( std::vector<unsigned short>( samples, samples + hit.trace_length ) );
+		data_packet->SetData( sort_febex );
 		
-	// Pause
-    if( my_info_code == set->GetPauseCode() ) {
-         
-		my_tm_stp_msb = my_info_field & 0x000FFFFF;
-		my_tm_stp = ( my_tm_stp_hsb << 48 ) | ( my_tm_stp_msb << 28 ) | ( my_tm_stp_lsb & 0x0FFFFFFF );
-		hfebex_pause[my_sfp_id][my_board_id]->Fill( ctr_febex_pause[my_sfp_id][my_board_id], my_tm_stp, 1 );
-		ctr_febex_pause[my_sfp_id][my_board_id]++;
-
-    }
-
-	// Resume
-	if( my_info_code == set->GetResumeCode() ) {
-         
-		my_tm_stp_msb = my_info_field & 0x000FFFFF;
-		my_tm_stp = ( my_tm_stp_hsb << 48 ) | ( my_tm_stp_msb << 28 ) | ( my_tm_stp_lsb & 0x0FFFFFFF );
-		hfebex_resume[my_sfp_id][my_board_id]->Fill( ctr_febex_resume[my_sfp_id][my_board_id], my_tm_stp, 1 );
-		ctr_febex_resume[my_sfp_id][my_board_id]++;
-
-    }
-
-	// Create an info event and fill the tree for external triggers and pause/resume
-	if( my_info_code == set->GetPauseCode() ||
-	    my_info_code == set->GetResumeCode() ) {
-
-		info_data->SetSfp( my_sfp_id );
-		info_data->SetBoard( my_board_id );
-		info_data->SetTime( my_tm_stp );
-		info_data->SetCode( my_info_code );
-		data_packet->SetData( info_data );
-		output_tree->Fill();
-		info_data->Clear();
-
 	}
-
+	
+	sorted_tree->Fill();
+	
 	return;
 	
 }
 
-// Common function called to process data in a block from file or DataSpy
-bool Converter::ProcessCurrentBlock( int nblock ) {
+// Empty the output trees, ready for the next lot of sorted hits
+void Converter::ResetSortedTree(){
 	
-	// Process header.
-	ProcessBlockHeader( nblock );
+	sorted_tree->Reset();
+	if( sample_tree ) sample_tree->Reset();
+	flat_nsamples = 0;
+	flat_sample_pos = 0;
+	flag_reset_sorted = false;
+	
+	return;
+	
+}
 
-	// Process the main block data until terminator found
-	data = (ULong64_t *)(block_data);
-	ProcessBlockData( nblock );
-			
-	// Check once more after going over left overs....
-	if( !flag_terminator ){
+// Fill the last, partly used, entry of the sample tree.
+// The rest of it is padded with zeros and the next trace starts in a new entry.
+void Converter::FlushSamples(){
+	
+	if( !sample_tree || flat_nsamples == 0 ) return;
+	
+	std::fill( flat_samples.begin() + flat_nsamples, flat_samples.end(), 0 );
+	sample_tree->Fill();
+	flat_sample_pos += SortHit::samples_per_entry - flat_nsamples;
+	flat_nsamples = 0;
+	
+	return;
+	
+}
 
-		std::cout << std::endl << __PRETTY_FUNCTION__ << std::endl;
-		std::cout << "\tERROR - Terminator sequence not found in data.\n";
-		return false;
-		
-	}
+// Put a hit in the reorder buffer, then fill any hits that are now
+// older than the sort window in to the tree
+void Converter::ReorderData( ReorderHit &rhit ){
+	
+	// Count anything arriving after we already filled a later hit
+	if( rhit.hit.time < reorder_last ) ctr_reorder_late++;
+	
+	rhit.seq = reorder_seq++;
+	reorder_buffer.push_back( std::move( rhit ) );
+	std::push_heap( reorder_buffer.begin(), reorder_buffer.end(), std::greater<ReorderHit>() );
+	
+	if( reorder_buffer.back().hit.time > reorder_newest )
+		reorder_newest = reorder_buffer.back().hit.time;
+	
+	ULong64_t window = set->GetSortWindow();
+	while( !reorder_buffer.empty() &&
+		   reorder_buffer.front().hit.time + window < reorder_newest )
+		EmitReorderHit();
+	
+	return;
+	
+}
 
-	return true;
+// Fill the earliest hit in the reorder buffer in to the tree
+void Converter::EmitReorderHit(){
+	
+	std::pop_heap( reorder_buffer.begin(), reorder_buffer.end(), std::greater<ReorderHit>() );
+	
+	ReorderHit &rhit = reorder_buffer.back();
+	FillSortedData( rhit.hit, rhit.samples.data() );
+	if( rhit.hit.time > reorder_last ) reorder_last = rhit.hit.time;
+	ctr_reorder_fill++;
+	
+	reorder_buffer.pop_back();
+	
+	return;
+	
+}
 
+// Sort each queue on its own, which is quick if it's nearly in order
+void Converter::SortQueues(){
+	
+	auto earlier = []( const SortHit &a, const SortHit &b ){ return a.time < b.time; };
+	
+	for( unsigned int q = 0; q < sort_queue.size(); ++q )
+		if( !std::is_sorted( sort_queue[q].begin(), sort_queue[q].end(), earlier ) )
+			std::stable_sort( sort_queue[q].begin(), sort_queue[q].end(), earlier );
+	
+	return;
+	
 }
 
-// Function to convert a block of data from DataSpy
-int Converter::ConvertBlock( char *input_block, int nblock ) {
+// A new file name for a sorted chunk, unique to this Converter
+std::string Converter::SortChunkName(){
 	
-	// Get the header.
-	std::memmove( &block_header, &input_block[0], HEADER_SIZE );
+	std::string name = sort_dir + "/mb_sort_" + std::to_string( getpid() );
+	name += "_" + std::to_string( (unsigned long)this );
+	name += "_" + std::to_string( sort_chunk_count++ ) + ".tmp";
 	
-	// Get the block
-	std::memmove( &block_data, &input_block[HEADER_SIZE], MAIN_SIZE );
+	return name;
 	
-	// Process the data
-	ProcessCurrentBlock( nblock );
+}
 
-	return nblock+1;
+// Read the next hit of a chunk, false at the end of it. If it can't
+// be read, those hits would be missing from the output, so give up
+// and leave the chunks on disk.
+bool Converter::ReadChunk( SortChunk &chunk ){
+	
+	if( chunk.Next() ) return true;
+	if( !chunk.failed ) return false;
+	
+	std::cerr << "Cannot read sorted hits from " << chunk.name;
+	std::cerr << ", the chunks are kept in " << sort_dir << std::endl;
+	exit(1);
 	
 }
 
-// Function to run the conversion for a single file
-int Converter::ConvertFile( std::string input_file_name,
-							 unsigned long start_block,
-							 long end_block ) {
+// Write all of the queued hits to disk as one sorted chunk
+void Converter::SpillQueues(){
 	
-	// Read the file.
-	std::ifstream input_file( input_file_name, std::ios::in|std::ios::binary );
-	if( !input_file.is_open() ){
+	std::string name = SortChunkName();
+	std::ofstream spill( name, std::ios::out|std::ios::binary|std::ios::trunc );
+	if( !spill.is_open() ) {
 		
-		std::cout << "Cannot open " << input_file_name << std::endl;
-		return -1;
+		std::cout << "Cannot write sorted hits to " << name;
+		std::cout << ", keeping them in memory" << std::endl;
+		sort_bytes = 0;
+		return;
 		
 	}
-
-	// Conversion starting
-	std::cout << "Converting file: " << input_file_name;
-	std::cout << " from block " << start_block << std::endl;
 	
-	// Calculate the size of the file.
-	input_file.seekg( 0, input_file.end );
-	unsigned long long size_end = input_file.tellg();
-	input_file.seekg( 0, input_file.beg );
-	unsigned long long size_beg = input_file.tellg();
-	unsigned long long FILE_SIZE = size_end - size_beg;
-	
-	// Calculate the number of blocks in the file.
-	unsigned long BLOCKS_NUM = FILE_SIZE / DATA_BLOCK_SIZE;
+	SortQueues();
+	sort_chunks.push_back( name );
+	sort_chunk_hits += MergeSorted( &spill );
+	spill.close();
 	
-	//a sanity check for file size...
-	//QQQ: add more strict test?
-	if( FILE_SIZE % DATA_BLOCK_SIZE != 0 ){
+	if( spill.fail() ) {
+		
+		std::cerr << "Cannot write sorted hits to " << name << std::endl;
+		exit(1);
 		
-		std::cout << " *WARNING* " << __PRETTY_FUNCTION__;
-		std::cout << "\tMissing data blocks?" << std::endl;
-
 	}
 	
-	sslogs << "\t File size = " << FILE_SIZE << std::endl;
-	sslogs << "\tBlock size = " << DATA_BLOCK_SIZE << std::endl;
-	sslogs << "\t  N blocks = " << BLOCKS_NUM << std::endl;
-
-	std::cout << sslogs.str() << std::endl;
-	sslogs.str( std::string() ); // clean up
+	return;
 	
+}
 
-	// Data format: http://npg.dl.ac.uk/documents/edoc504/edoc504.html
-	// The information is split into 2 words of 32 bits (4 byte).
-	// We will collect the data in 64 bit words and split later
+// Merge the chunks in groups, each to a new chunk, until there are
+// few enough of them to be opened all at once
+void Converter::MergeChunks(){
 	
-	// Loop over all the blocks.
-	for( unsigned long nblock = 0; nblock < BLOCKS_NUM ; nblock++ ){
+	while( sort_chunks.size() > MAX_MERGE_CHUNKS ) {
 		
-		// Take one block each time and analyze it.
-		if( nblock % 200 == 0 || nblock+1 == BLOCKS_NUM ) {
-			
-			// Percent complete
-			float percent = (float)(nblock+1)*100.0/(float)BLOCKS_NUM;
+		std::cout << " Sorting: merging " << sort_chunks.size();
+		std::cout << " chunks on disk" << std::endl;
+		
+		// Neighbouring chunks are merged, so they stay in the order written
+		std::vector<std::string> merged;
+		for( unsigned int first = 0; first < sort_chunks.size(); first += MAX_MERGE_CHUNKS ) {
 			
-			// Progress bar in GUI
-			if( _prog_ ){
-				
-				prog->SetPosition( percent );
-				gSystem->ProcessEvents();
-
-			}
+			unsigned int last = std::min( first + MAX_MERGE_CHUNKS, (unsigned int)sort_chunks.size() );
+			if( last - first == 1 ) merged.push_back( sort_chunks[first] );
+			else merged.push_back( MergeChunkGroup( first, last ) );
 			
-			// Progress bar in terminal
-			std::cout << " " << std::setw(8) << std::setprecision(4);
-			std::cout << percent << "%\r";
-			std::cout.flush();
-
 		}
 		
+		sort_chunks = merged;
 		
-		// Get the header.
-		input_file.read( (char*)&block_header, HEADER_SIZE );
-		// Get the block
-		input_file.read( (char*)&block_data, MAIN_SIZE );
-
-
-		// Check if we are before the start block or after the end block
-		if( nblock < start_block || ( (long)nblock > end_block && end_block > 0 ) )
-			continue;
-
-
-		// Process current block. If it's the end, stop.
-		if( !ProcessCurrentBlock( nblock ) ) break;
-		
-	} // loop - nblock < BLOCKS_NUM
+	}
 	
-	input_file.close();
-
-	return BLOCKS_NUM;
+	return;
 	
 }
 
-unsigned long long Converter::SortTree(){
+// Merge the chunks from first up to last in to one new chunk
+std::string Converter::MergeChunkGroup( unsigned int first, unsigned int last ){
 	
-	// Reset the sorted tree so it's empty before we start
-	sorted_tree->Reset();
+	std::string name = SortChunkName();
+	std::ofstream merged( name, std::ios::out|std::ios::binary|std::ios::trunc );
+	if( !merged.is_open() ) {
+		
+		std::cerr << "Cannot write sorted hits to " << name << std::endl;
+		exit(1);
+		
+	}
+	
+	// Heap with the time of the next hit in each chunk, earliest first
+	std::vector<std::unique_ptr<SortChunk>> chunks;
+	typedef std::pair<ULong64_t,unsigned int> next_hit_t;
+	std::priority_queue<next_hit_t, std::vector<next_hit_t>, std::greater<next_hit_t>> next_hit;
+	for( unsigned int i = first; i < last; ++i ) {
+		
+		chunks.push_back( std::make_unique<SortChunk>() );
+		chunks.back()->Open( sort_chunks[i] );
+		if( ReadChunk( *chunks.back() ) )
+			next_hit.push( std::make_pair( chunks.back()->hit.time, i - first ) );
+		
+	}
 	
-	// Load the full tree if possible
-	output_tree->SetMaxVirtualSize(2e9); // 2GB
-	sorted_tree->SetMaxVirtualSize(2e9); // 2GB
-	output_tree->LoadBaskets(1e9); 		 // Load 1 GB of data to memory
+	while( !next_hit.empty() ) {
+		
+		unsigned int j = next_hit.top().second;
+		next_hit.pop();
+		
+		merged.write( (const char*)&chunks[j]->hit, sizeof(SortHit) );
+		merged.write( (const char*)chunks[j]->samples.data(),
+					 chunks[j]->hit.trace_length * sizeof(unsigned short) );
+		
+		if( ReadChunk( *chunks[j] ) )
+			next_hit.push( std::make_pair( chunks[j]->hit.time, j ) );
+		
+	}
 	
-	// Check we have entries and build time-ordered index
-	if( output_tree->GetEntries() ){
-
-		std::cout << "Building time-ordered index of events..." << std::endl;
-		output_tree->BuildIndex( "data.GetTime()" );
-
+	merged.close();
+	if( merged.fail() ) {
+		
+		std::cerr << "Cannot write sorted hits to " << name << std::endl;
+		exit(1);
+		
 	}
-	else return 0;
 	
-	// Get index and prepare for sorting
-	TTreeIndex *att_index = (TTreeIndex*)output_tree->GetTreeIndex();
-	unsigned long long nb_idx = att_index->GetN();
-	std::cout << " Sorting: size of the sorted index = " << nb_idx << std::endl;
+	// The old chunks are all in the new one now
+	chunks.clear();
+	for( unsigned int i = first; i < last; ++i )
+		std::remove( sort_chunks[i].data() );
+	
+	return name;
+	
+}
 
-	// Loop on t_raw entries and fill t
-	for( unsigned long i = 0; i < nb_idx; ++i ) {
+// Merge the sorted queues, and the chunks on disk, in time order,
+// always taking the earliest hit at the front of any of them.
+// The hits go to the output tree, or to a new chunk if spill is given.
+unsigned long long Converter::MergeSorted( std::ofstream *spill ){
+	
+	// Open the chunks, unless we are making a new one
+	std::vector<std::unique_ptr<SortChunk>> chunks;
+	for( unsigned int i = 0; i < sort_chunks.size() && !spill; ++i ) {
+		
+		chunks.push_back( std::make_unique<SortChunk>() );
+		chunks.back()->Open( sort_chunks[i] );
+		ReadChunk( *chunks.back() );
+		
+	}
+	
+	// Total number of hits, for the progress bar
+	unsigned long long nb_idx = 0;
+	if( !spill ) nb_idx = sort_chunk_hits;
+	for( unsigned int q = 0; q < sort_queue.size(); ++q )
+		nb_idx += sort_queue[q].size();
+	
+	// Heap with the time of the next hit in each chunk and then each
+	// queue, earliest first. Equal times are taken by source, the chunks
+	// in the order they were written and then the queues by number, so
+	// hits from different boards with the same time keep no arrival order.
+	unsigned int nchunks = chunks.size();
+	typedef std::pair<ULong64_t,unsigned int> next_hit_t;
+	std::priority_queue<next_hit_t, std::vector<next_hit_t>, std::greater<next_hit_t>> next_hit;
+	std::vector<unsigned long> pos( sort_queue.size(), 0 );
+	for( unsigned int i = 0; i < nchunks; ++i )
+		if( chunks[i]->file.good() ) next_hit.push( std::make_pair( chunks[i]->hit.time, i ) );
+	for( unsigned int q = 0; q < sort_queue.size(); ++q )
+		if( sort_queue[q].size() ) next_hit.push( std::make_pair( sort_queue[q][0].time, nchunks + q ) );
+	
+	// Merge them all
+	unsigned long long i = 0;
+	for( ; !next_hit.empty(); ++i ) {
 		
-		// Clean up old data
-		data_packet->ClearData();
+		unsigned int j = next_hit.top().second;
+		next_hit.pop();
 		
-		// Get time-ordered event index
-		unsigned long long idx = att_index->GetIndex()[i];
+		// The earliest hit and its trace
+		const SortHit *hit;
+		const unsigned short *samples;
+		if( j < nchunks ) {
+			
+			hit = &chunks[j]->hit;
+			samples = chunks[j]->samples.data();
+			
+		}
 		
-		// Check if the input or output trees are filling
-		if( output_tree->MemoryFull(30e6) )
-			output_tree->DropBaskets();
-		if( sorted_tree->MemoryFull(30e6) )
-			sorted_tree->FlushBaskets();
+		else {
+			
+			hit = &sort_queue[j-nchunks][pos[j-nchunks]];
+			samples = sort_samples[j-nchunks].data() + hit->trace_start;
+			
+		}
 		
-		// Get entry from unsorted tree and fill to sorted tree
-		output_tree->GetEntry( idx );
-		sorted_tree->Fill();
-
-		// Optimise filling tree
-		if( i == 100 ) sorted_tree->OptimizeBaskets(30e6);	 // sorted tree basket size max 30 MB
-
-		// Progress bar
-		bool update_progress = false;
-		if( nb_idx < 200 )
-			update_progress = true;
-		else if( i % (nb_idx/100) == 0 || i+1 == nb_idx )
-			update_progress = true;
+		// Write it to the new chunk
+		if( spill ) {
+			
+			spill->write( (const char*)hit, sizeof(SortHit) );
+			spill->write( (const char*)samples, hit->trace_length * sizeof(unsigned short) );
+			
+		}
 		
-		if( update_progress ) {
+		// Or fill it in the tree
+		else {
+			
+			FillSortedData( *hit, samples );
 			
-			// Percent complete
-			float percent = (float)(i+1)*100.0/(float)nb_idx;
+			// Check if the output tree is filling
+			if( sorted_tree->MemoryFull(30e6) )
+				sorted_tree->FlushBaskets();
 			
-			// Progress bar in GUI
-			if( _prog_ ) {
+			// Optimise filling tree
+			if( i == 100 ) sorted_tree->OptimizeBaskets(30e6);	 // sorted tree basket size max 30 MB
+			
+			// Progress bar
+			bool update_progress = false;
+			if( nb_idx < 200 )
+				update_progress = true;
+			else if( i % (nb_idx/100) == 0 || i+1 == nb_idx )
+				update_progress = true;
+			
+			if( update_progress ) {
+				
+				// Percent complete
+				float percent = (float)(i+1)*100.0/(float)nb_idx;
+				
+				// Progress bar in GUI
+				if( _prog_ ) {
+					
+					prog->SetPosition( percent );
+					gSystem->ProcessEvents();
+					
+				}
 				
-				prog->SetPosition( percent );
-				gSystem->ProcessEvents();
+				// Progress bar in terminal
+				if( job_name.size() ) PrintJobProgress( "time ordering", percent );
+				else {
+					
+					std::cout << " " << std::setw(6) << std::setprecision(4);
+					std::cout << percent << "%    \r";
+					std::cout.flush();
+					
+				}
 				
 			}
 			
-			// Progress bar in terminal
-			std::cout << " " << std::setw(6) << std::setprecision(4);
-			std::cout << percent << "%    \r";
-			std::cout.flush();
-
 		}
-
+		
+		// Put the next hit from the same place in
+		if( j < nchunks ) {
+			
+			if( ReadChunk( *chunks[j] ) )
+				next_hit.push( std::make_pair( chunks[j]->hit.time, j ) );
+			
+		}
+		
+		else if( ++pos[j-nchunks] < sort_queue[j-nchunks].size() )
+			next_hit.push( std::make_pair( sort_queue[j-nchunks][pos[j-nchunks]].time, j ) );
+		
+	}
+	
+	// Empty the queues so they're ready for the next hits
+	for( unsigned int q = 0; q < sort_queue.size(); ++q ) {
+		
+		sort_queue[q].clear();
+		sort_samples[q].clear();
+		
+	}
+	sort_bytes = 0;
+	
+	// The chunks are finished with once they're in the tree
+	if( !spill ) {
+		
+		for( unsigned int k = 0; k < sort_chunks.size(); ++k )
+			std::remove( sort_chunks[k].data() );
+		
+		sort_chunks.clear();
+		sort_chunk_hits = 0;
+		
 	}
 	
-	// Reset the output tree so it's empty after we've finished
-	output_tree->FlushBaskets();
-	output_tree->Reset();
+	return i;
+	
+}
 
+// Time sort all of the hits in to the output tree.
+// Each board gives its data nearly in time order, so each queue is
+// sorted on its own and then they are merged with any sorted chunks
+// that had to be written to disk.
+unsigned long long Converter::SortTree(){
+	
+	// With the streaming sort, the tree is already filled, so just put
+	// in what's left and mark the tree to be emptied on the next hit
+	if( set->GetSortWindow() > 0 ) {
+		
+		if( flag_reset_sorted ) ResetSortedTree();
+		while( !reorder_buffer.empty() )
+			EmitReorderHit();
+		FlushSamples();
+		
+		if( ctr_reorder_late ) {
+			
+			std::cout << " Sorting: " << ctr_reorder_late;
+			std::cout << " hits arrived later than the sort window of ";
+			std::cout << set->GetSortWindow() << " ns" << std::endl;
+			
+		}
+		
+		unsigned long long nb_idx = ctr_reorder_fill;
+		ctr_reorder_fill = 0;
+		ctr_reorder_late = 0;
+		reorder_newest = 0;
+		reorder_last = 0;
+		flag_reset_sorted = true;
+		
+		return nb_idx;
+		
+	}
+	
+	// Reset the sorted tree so it's empty before we start
+	ResetSortedTree();
+	
+	// Check we have some hits
+	unsigned long long nb_idx = sort_chunk_hits;
+	for( unsigned int q = 0; q < sort_queue.size(); ++q )
+		nb_idx += sort_queue[q].size();
+	
+	if( nb_idx == 0 ) return 0;
+	
+	std::cout << " Sorting: number of hits = " << nb_idx;
+	if( sort_chunks.size() )
+		std::cout << ", with " << sort_chunks.size() << " chunks on disk";
+	std::cout << std::endl;
+	
+	SortQueues();
+	MergeChunks();
+	nb_idx = MergeSorted();
+	FlushSamples();
+	
 	return nb_idx;
 	
 }
@@ -1,5 +1,7 @@
 #include "DataPackets.hh"
 
+#include "TTree.h"
+
 ClassImp(FebexData)
 ClassImp(InfoData)
 ClassImp(DataPackets)
@@ -9,7 +11,7 @@ FebexData::FebexData( unsigned long long t,
 				    std::vector<unsigned short> tr,
 					unsigned char s, unsigned char b, unsigned char c,
 				    bool th, bool v, bool f ) :
-					time(t), Qfloat(qf), Qhalf(qh), Qint(qi), trace(tr), sfp(s), board(b), ch(c), thres(th), veto(v), fail(f) {}
+					time(t), Qfloat(qf), Qhalf(qh), Qint(qi), trace_length(tr.size()), trace(tr), sfp(s), board(b), ch(c), thres(th), veto(v), fail(f) {}
 
 InfoData::InfoData( unsigned long long t, unsigned char c, unsigned char s, unsigned char b ) :
 					time(t), code(c), sfp(s), board(b) {}
@@ -26,7 +28,8 @@ void DataPackets::SetData( std::shared_ptr<FebexData> data ){
 	FebexData fill_data;
 	
 	fill_data.SetTime( data->GetTime() );
-	fill_data.SetTrace( data->GetTrace() );
+	const std::vector<unsigned short> &trace = data->GetTrace();
+	fill_data.SetPackedTrace( trace.data(), trace.size() );
 	fill_data.SetQint( data->GetQint() );
 	fill_data.SetQhalf( data->GetQhalf() );
 	fill_data.SetQfloat( data->GetQfloat() );
@@ -90,11 +93,44 @@ UInt_t DataPackets::GetTimeLSB(){
 	
 }
 
+// Compress the trace, ready to be written to the tree.
+// The samples are only unpacked again if someone asks for them.
+void FebexData::SetPackedTrace( const unsigned short *samples, unsigned short nsamples ){
+	
+	TraceCodec::Encode( samples, nsamples, packed_trace );
+	trace_length = nsamples;
+	trace.clear();
+	
+	return;
+	
+}
+
+void FebexData::UnpackTrace(){
+	
+	// Nothing to unpack if the trace wasn't read from the tree
+	trace.resize( trace_length );
+	if( packed_trace.empty() ) std::fill( trace.begin(), trace.end(), 0 );
+	
+	else if( !TraceCodec::Decode( packed_trace.data(), packed_trace.size(),
+							trace.data(), trace_length ) ) {
+		
+		std::cerr << "Corrupt trace for SFP " << (int)sfp << ", board " << (int)board;
+		std::cerr << ", channel " << (int)ch << std::endl;
+		std::fill( trace.begin(), trace.end(), 0 );
+		
+	}
+	
+	return;
+	
+}
+
 void FebexData::ClearData(){
 	
+	// Keep the memory for the trace, so it can be reused for the next hit
 	time = 0;
 	trace.clear();
-	std::vector<unsigned short>().swap(trace);
+	packed_trace.clear();
+	trace_length = 0;
 	Qint = 0;
 	Qhalf = 0.;
 	Qfloat = 0.;
@@ -121,3 +157,51 @@ void InfoData::ClearData(){
 	
 }
 
+
+void SortHit::MakeBranches( TTree *tree ){
+	
+	tree->Branch( "time", &time, "time/l" );
+	tree->Branch( "energy", &energy, "energy/F" );
+	tree->Branch( "Qint", &Qint, "Qint/s" );
+	tree->Branch( "Qhalf", &Qhalf, "Qhalf/F" );
+	tree->Branch( "Qfloat", &Qfloat, "Qfloat/F" );
+	tree->Branch( "sfp", &sfp, "sfp/b" );
+	tree->Branch( "board", &board, "board/b" );
+	tree->Branch( "ch", &ch, "ch/b" );
+	tree->Branch( "code", &code, "code/b" );
+	tree->Branch( "flags", &flags, "flags/b" );
+	tree->Branch( "trace_start", &trace_start, "trace_start/l" );
+	tree->Branch( "trace_length", &trace_length, "trace_length/s" );
+
+	return;
+	
+}
+
+void SortHit::SetBranchAddresses( TTree *tree, bool read_trace ){
+	
+	tree->SetBranchAddress( "time", &time );
+	tree->SetBranchAddress( "energy", &energy );
+	tree->SetBranchAddress( "Qint", &Qint );
+	tree->SetBranchAddress( "Qhalf", &Qhalf );
+	tree->SetBranchAddress( "Qfloat", &Qfloat );
+	tree->SetBranchAddress( "sfp", &sfp );
+	tree->SetBranchAddress( "board", &board );
+	tree->SetBranchAddress( "ch", &ch );
+	tree->SetBranchAddress( "code", &code );
+	tree->SetBranchAddress( "flags", &flags );
+	
+	// Don't even read the trace position if we don't need it
+	tree->SetBranchStatus( "trace_start", read_trace );
+	tree->SetBranchStatus( "trace_length", read_trace );
+	trace_start = 0;
+	trace_length = 0;
+	if( read_trace ) {
+		
+		tree->SetBranchAddress( "trace_start", &trace_start );
+		tree->SetBranchAddress( "trace_length", &trace_length );
+		
+	}
+
+	return;
+	
+}
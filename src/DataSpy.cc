@@ -113,7 +113,6 @@ int DataSpy::ReadWithSeq( int id, char *data, unsigned int length, int *seq ) {
 	
 	int *bufferaddress;
 	unsigned int len;
-	int *ptr;
 	
 	
 	if( id < 0 || id >= MAX_ID ) {
@@ -143,10 +142,9 @@ retry:
 				printf( "DataSpy::Read id %d: Age %lld Index %d Buffer length %d\n",
 						id, current_age[id], next_index[id], len );
 			
-			// copy data from shared memory to user buffer
-			ptr = (int*)data;
-			for( unsigned int i = 0; i < (len >> 2); i++ )
-				ptr[i] = bufferaddress[i];
+			// copy data from shared memory to user buffer, in one go.
+			// This is the only copy, the Converter decodes from data.
+			memcpy( data, bufferaddress, len & ~0x3 );
 			*seq = (int)current_age[id];
 			
 			// check if the entry could have changed while copying (can happen) and if so retry
@@ -114,8 +114,10 @@ void EventBuilder::SetInputFile( std::string input_file_name ) {
 	
 	flag_input_file = true;
 	
-	// Set the input tree
-	SetInputTree( (TTree*)input_file->Get("mb_sort") );
+	// Set the input tree, which is flat if there is one
+	if( input_file->GetListOfKeys()->Contains( "mb_hits" ) )
+		SetInputTree( (TTree*)input_file->Get("mb_hits") );
+	else SetInputTree( (TTree*)input_file->Get("mb_sort") );
 	StartFile();
 
 	return;
@@ -127,8 +129,70 @@ void EventBuilder::SetInputTree( TTree *user_tree ){
 	// Find the tree and set branch addresses
 	input_tree = user_tree;
 	in_data = nullptr;
-	input_tree->SetBranchAddress( "data", &in_data );
+	
+	// The flat tree has a branch for every variable and no DataPackets.
+	// We don't need the traces, so they are not even read.
+	flag_flat_input = !input_tree->GetBranch( "data" );
+	if( flag_flat_input ) {
+		
+		flat_hit.SetBranchAddresses( input_tree, false );
+		febex_data = std::make_shared<FebexData>();
+		info_data = std::make_shared<InfoData>();
+		
+	}
+	
+	// The traces are in their own branch, so we can skip them here too
+	else {
+		
+		input_tree->SetBranchAddress( "data", &in_data );
+		input_tree->SetBranchStatus( "*trace*", false );
+		
+	}
+
+	return;
+	
+}
+
+void EventBuilder::GetFebexHit(){
+	
+	if( !flag_flat_input ) {
+		
+		febex_data = in_data->GetFebexData();
+		return;
+		
+	}
+	
+	// Fill the variables we use, without the trace
+	febex_data->SetTime( flat_hit.time );
+	febex_data->SetEnergy( flat_hit.energy );
+	febex_data->SetQfloat( flat_hit.Qfloat );
+	febex_data->SetQhalf( flat_hit.Qhalf );
+	febex_data->SetQint( flat_hit.Qint );
+	febex_data->SetSfp( flat_hit.sfp );
+	febex_data->SetBoard( flat_hit.board );
+	febex_data->SetChannel( flat_hit.ch );
+	febex_data->SetThreshold( flat_hit.flags & SortHit::HIT_THRES );
+	febex_data->SetVeto( flat_hit.flags & SortHit::HIT_VETO );
+	febex_data->SetFail( flat_hit.flags & SortHit::HIT_FAIL );
+	
+	return;
+	
+}
 
+void EventBuilder::GetInfoHit(){
+	
+	if( !flag_flat_input ) {
+		
+		info_data = in_data->GetInfoData();
+		return;
+		
+	}
+	
+	info_data->SetTime( flat_hit.time );
+	info_data->SetCode( flat_hit.code );
+	info_data->SetSfp( flat_hit.sfp );
+	info_data->SetBoard( flat_hit.board );
+	
 	return;
 	
 }
@@ -235,7 +299,7 @@ unsigned long EventBuilder::BuildEvents() {
 		if( i == 0 ) input_tree->GetEntry(i);
 
 		// Get the time of the event
-		mytime = in_data->GetTime();
+		mytime = GetHitTime();
 				
 		// check time stamp monotonically increases!
 		if( time_prev > mytime ) {
@@ -255,23 +319,33 @@ unsigned long EventBuilder::BuildEvents() {
 		// ------------------------------------------ //
 		// Find FEBEX data
 		// ------------------------------------------ //
-		if( in_data->IsFebex() ) {
+		if( IsFebexHit() ) {
 			
 			// Increment event counter
 			n_febex_data++;
 			
-			febex_data = in_data->GetFebexData();
+			GetFebexHit();
 			mysfp = febex_data->GetSfp();
 			myboard = febex_data->GetBoard();
 			mych = febex_data->GetChannel();
 			if( overwrite_cal ) {
 				
-				myenergy = cal->FebexEnergy( mysfp, myboard, mych,
-									febex_data->GetQint() );
+				// Look up the channel once for the energy and threshold,
+				// anything outside the table has no calibration
+				if( cal->IsFebexChannel( mysfp, myboard, mych ) ) {
+					
+					const FebexChannelCal &c = cal->GetFebexCal( cal->GetFebexIndex( mysfp, myboard, mych ) );
+					myenergy = cal->FebexEnergy( c, febex_data->GetQint() );
+					mythres = febex_data->GetQint() > c.threshold;
+					
+				}
 				
-				if( febex_data->GetQint() > cal->FebexThreshold( mysfp, myboard, mych ) )
+				else {
+					
+					myenergy = -1;
 					mythres = true;
-				else mythres = false;
+					
+				}
 
 			}
 			
@@ -282,8 +356,11 @@ unsigned long EventBuilder::BuildEvents() {
 
 			}
 			
+			// What detector is it?
+			const ChannelDescriptor &desc = set->GetChannel( mysfp, myboard, mych );
+			
 			// Is it a gamma ray from Miniball?
-			if( set->IsMiniball( mysfp, myboard, mych ) && mythres ) {
+			if( desc.type == ChannelDescriptor::DET_MINIBALL && mythres ) {
 				
 				// Increment counts and open the event
 				n_miniball++;
@@ -291,14 +368,14 @@ unsigned long EventBuilder::BuildEvents() {
 				
 				mb_en_list.push_back( myenergy );
 				mb_ts_list.push_back( mytime );
-				mb_clu_list.push_back( set->GetMiniballCluster( mysfp, myboard, mych ) );
-				mb_cry_list.push_back( set->GetMiniballCrystal( mysfp, myboard, mych ) );
-				mb_seg_list.push_back( set->GetMiniballSegment( mysfp, myboard, mych ) );
+				mb_clu_list.push_back( desc.id[0] );
+				mb_cry_list.push_back( desc.id[1] );
+				mb_seg_list.push_back( desc.id[2] );
 				
 			}
 			
 			// Is it a partile from the CD?
-			else if( set->IsCD( mysfp, myboard, mych ) && mythres ) {
+			else if( desc.type == ChannelDescriptor::DET_CD && mythres ) {
 				
 				// Increment counts and open the event
 				n_cd++;
@@ -306,10 +383,10 @@ unsigned long EventBuilder::BuildEvents() {
 				
 				cd_en_list.push_back( myenergy );
 				cd_ts_list.push_back( mytime );
-				cd_det_list.push_back( set->GetCDDetector( mysfp, myboard, mych ) );
-				cd_sec_list.push_back( set->GetCDSector( mysfp, myboard, mych ) );
-				cd_side_list.push_back( set->GetCDSide( mysfp, myboard, mych ) );
-				cd_strip_list.push_back( set->GetCDStrip( mysfp, myboard, mych ) );
+				cd_det_list.push_back( desc.id[0] );
+				cd_sec_list.push_back( desc.id[1] );
+				cd_side_list.push_back( desc.id[2] );
+				cd_strip_list.push_back( desc.id[3] );
 				
 			}
 			
@@ -328,12 +405,12 @@ unsigned long EventBuilder::BuildEvents() {
 		// ------------------------------------------ //
 		// Find info events, like timestamps etc
 		// ------------------------------------------ //
-		else if( in_data->IsInfo() ) {
+		else if( IsInfoHit() ) {
 			
 			// Increment event counter
 			n_info_data++;
 			
-			info_data = in_data->GetInfoData();
+			GetInfoHit();
 			
 			// Update EBIS time
 			if( info_data->GetCode() == set->GetEBISCode() &&
@@ -436,7 +513,7 @@ unsigned long EventBuilder::BuildEvents() {
 
 		// Sort out the timing for the event window
 		// but only if it isn't an info event, i.e only for real data
-		if( !in_data->IsInfo() ) {
+		if( !IsInfoHit() ) {
 			
 			// if this is first datum included in Event
 			if( hit_ctr == 1 && mythres ) {
@@ -459,7 +536,7 @@ unsigned long EventBuilder::BuildEvents() {
 		
 		if( input_tree->GetEntry(i+1) ) {
 						
-			time_diff = in_data->GetTime() - time_first;
+			time_diff = GetHitTime() - time_first;
 
 			// window = time_stamp_first + time_window
 			if( time_diff > build_window )
@@ -470,7 +547,7 @@ unsigned long EventBuilder::BuildEvents() {
 				flag_close_event = true; // set flag to close this event
 				
 			// Fill tdiff hist only for real data
-			if( !in_data->IsInfo() ) {
+			if( !IsInfoHit() ) {
 				
 				tdiff->Fill( time_diff );
 				if( !mythres )
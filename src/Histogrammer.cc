@@ -794,6 +794,28 @@ void Histogrammer::FillParticleElectronHists( std::shared_ptr<SpedeEvt> e ) {
 
 }
 
+// Empty every histogram, e.g. when the reaction changes in the monitor.
+// Starts from the output file and goes through each directory in it.
+void Histogrammer::ResetHists( TDirectory *dir ) {
+	
+	if( !dir ) dir = output_file;
+	if( !dir ) return;
+	
+	TIter next( dir->GetList() );
+	TObject *obj;
+	while( ( obj = next() ) ) {
+		
+		if( obj->InheritsFrom( TDirectory::Class() ) )
+			ResetHists( (TDirectory*)obj );
+		else if( obj->InheritsFrom( TH1::Class() ) )
+			( (TH1*)obj )->Reset();
+		
+	}
+	
+	return;
+	
+}
+
 unsigned long Histogrammer::FillHists() {
 	
 	/// Main function to fill the histograms
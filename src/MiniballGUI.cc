@@ -214,6 +214,17 @@ MiniballGUI::MiniballGUI() {
 	check_event = new TGCheckButton( centre_go, "Rebuild events" );
 	centre_go->AddFrame( check_event, new TGLayoutHints( kLHintsLeft, 2, 2, 2, 2 ) );
 
+	//-----------------------//
+	// Create number entries //
+	//-----------------------//
+
+	lab_jobs = new TGLabel( centre_go, "Files at once:" );
+	centre_go->AddFrame( lab_jobs, new TGLayoutHints( kLHintsLeft | kLHintsCenterY, 2, 2, 2, 2 ) );
+
+	num_jobs = new TGNumberEntry( centre_go, 1, 3, -1, TGNumberFormat::kNESInteger,
+								 TGNumberFormat::kNEAPositive, TGNumberFormat::kNELLimitMinMax, 1, 64 );
+	centre_go->AddFrame( num_jobs, new TGLayoutHints( kLHintsLeft, 2, 2, 2, 2 ) );
+
 
 	//-----------------------//
 	// Create action buttons //
@@ -464,6 +475,7 @@ void MiniballGUI::SaveSetup( TString setupfile ) {
 	fSetup->SetValue( "filelist", list_of_files );
 	fSetup->SetValue( "force", check_force->IsOn() );
 	fSetup->SetValue( "events", check_event->IsOn() );
+	fSetup->SetValue( "jobs", (int)num_jobs->GetIntNumber() );
 
 	fSetup->WriteFile( setupfile );
 
@@ -499,6 +511,7 @@ void MiniballGUI::LoadSetup( TString setupfile ) {
 
 	check_force->SetOn( fSetup->GetValue( "force", false ) );
 	check_event->SetOn( fSetup->GetValue( "event", false ) );
+	num_jobs->SetIntNumber( fSetup->GetValue( "jobs", 1 ) );
 
 }
 
@@ -518,6 +531,7 @@ void MiniballGUI::gui_convert(){
 	std::ifstream ftest;
 	TString name_input_file;
 	TString name_output_file;
+	std::vector<unsigned int> convert_list;
 	
 	// Check each file
 	for( unsigned int i = 0; i < filelist.size(); i++ ){
@@ -561,6 +575,14 @@ void MiniballGUI::gui_convert(){
 			std::cout << name_input_file << " --> ";
 			std::cout << name_output_file << std::endl;
 			
+			// Leave it for the pool of jobs
+			if( njobs > 1 ) {
+				
+				convert_list.push_back( i );
+				continue;
+				
+			}
+			
 			prog_format  = "Converting ";
 			prog_format += name_input_file( name_input_file.Last('/') + 1,
 					name_input_file.Length() - name_input_file.Last('/') ).Data();
@@ -577,21 +599,17 @@ void MiniballGUI::gui_convert(){
 			prog_format  = "Converter complete";
 			prog_conv->ShowPosition( true, false, prog_format.data() );
 
-			// Time sorting
-			if( !flag_source ) {
-
-				prog_format  = "Time ordering ";
-				prog_format += name_input_file( name_input_file.Last('/') + 1,
-											   name_input_file.Length() - name_input_file.Last('/') ).Data();
-				prog_format += ": %.0f%%";
-				prog_sort->ShowPosition( true, false, prog_format.data() );
-				conv.AddProgressBar( prog_sort );
-				conv.SortTree();
-				
-				prog_format  = "Time ordering complete";
-				prog_conv->ShowPosition( true, false, prog_format.data() );
-
-			}
+			// Time sorting, which also fills the tree
+			prog_format  = "Time ordering ";
+			prog_format += name_input_file( name_input_file.Last('/') + 1,
+										   name_input_file.Length() - name_input_file.Last('/') ).Data();
+			prog_format += ": %.0f%%";
+			prog_sort->ShowPosition( true, false, prog_format.data() );
+			conv.AddProgressBar( prog_sort );
+			conv.SortTree();
+			
+			prog_format  = "Time ordering complete";
+			prog_conv->ShowPosition( true, false, prog_format.data() );
 
 			// Close file
 			conv.CloseOutput();
@@ -603,6 +621,67 @@ void MiniballGUI::gui_convert(){
 		
 	}
 	
+	if( convert_list.size() == 0 ) return;
+	
+	// Convert the files in a pool of jobs, each with its own Converter.
+	// Settings and calibration are only read, so they are shared.
+	// The GUI is only touched from here, so the progress bar counts the
+	// files that are finished and each file reports to the terminal.
+	ROOT::EnableThreadSafety();
+	std::atomic<unsigned int> next_file( 0 );
+	std::atomic<unsigned int> files_done( 0 );
+	std::vector<std::thread> jobs;
+	for( int j = 0; j < njobs && j < (int)convert_list.size(); j++ ) {
+		
+		jobs.emplace_back( [this,&convert_list,&next_file,&files_done](){
+			
+			unsigned int k;
+			while( ( k = next_file++ ) < convert_list.size() ) {
+				
+				TString input_file = filelist.at( convert_list[k] );
+				TString output_file = input_file;
+				if( flag_source ) output_file += "_source.root";
+				else output_file += ".root";
+				
+				Converter job_conv( myset );
+				job_conv.AddCalibration( mycal );
+				job_conv.SetJobName( input_file.Data() );
+				if( flag_source ) job_conv.SourceOnly();
+				job_conv.SetOutput( output_file.Data() );
+				job_conv.MakeTree();
+				job_conv.MakeHists();
+				job_conv.ConvertFile( input_file.Data() );
+				job_conv.SortTree();
+				job_conv.CloseOutput();
+				files_done++;
+				
+			}
+			
+		} );
+		
+	}
+	
+	prog_format  = "Converting ";
+	prog_format += std::to_string( convert_list.size() );
+	prog_format += " files: %.0f%%";
+	prog_conv->ShowPosition( true, false, prog_format.data() );
+	
+	while( files_done < convert_list.size() ) {
+		
+		prog_conv->SetPosition( 100.0 * files_done / convert_list.size() );
+		gSystem->ProcessEvents();
+		gSystem->Sleep( 100 );
+		
+	}
+	
+	for( unsigned int j = 0; j < jobs.size(); j++ )
+		jobs[j].join();
+	
+	prog_conv->SetPosition( 100.0 );
+	prog_format  = "Converter complete";
+	prog_conv->ShowPosition( true, false, prog_format.data() );
+	gSystem->ProcessEvents();
+	
 	return;
 	
 }
@@ -764,6 +843,7 @@ void MiniballGUI::on_sort_clicked() {
 	flag_source = check_source->IsOn();
 	flag_convert = check_force->IsOn();
 	flag_events = check_event->IsOn();
+	njobs = num_jobs->GetIntNumber();
 
 	//------------------//
 	// Run the analysis //
@@ -1,4 +1,5 @@
 #include "Settings.hh"
+#include "ConfigCache.hh"
 
 ClassImp(Settings)
 
@@ -18,6 +19,15 @@ Settings::Settings( std::string filename ) {
 
 void Settings::ReadSettings() {
 	
+	// Everything from last time, if the file hasn't changed since
+	ConfigCache cache( fInputFile, Class_Version() );
+	if( cache.Load() ) {
+		
+		CacheSettings( cache );
+		if( cache.IsGood() ) return;
+		
+	}
+	
 	TEnv *config = new TEnv( fInputFile.data() );
 	
 	// FEBEX initialisation
@@ -68,6 +78,14 @@ void Settings::ReadSettings() {
 	// Data things
 	block_size			= config->GetValue( "DataBlockSize", 0x10000 );
 	flag_febex_only		= config->GetValue( "FebexOnlyData", true );
+	read_ahead			= config->GetValue( "ReadAheadBlocks", 0 );
+	checkpoint_blocks	= config->GetValue( "CheckpointBlocks", 0 );
+	
+	// Time sorting
+	sort_memory			= config->GetValue( "SortMemory", 2000 );
+	sort_dir			= config->GetValue( "SortScratchDir", "" );
+	sort_window			= config->GetValue( "SortWindow", 0.0 );
+	flag_flat_output	= config->GetValue( "FlatHitOutput", false );
 
 	
 	
@@ -310,9 +328,147 @@ void Settings::ReadSettings() {
 	} // i: SPEDE detector
 	
 	
+	// One descriptor for each channel, checking the maps in the same
+	// order as the event builder does
+	no_channel.type = ChannelDescriptor::DET_NONE;
+	for( unsigned int i = 0; i < 4; ++i )
+		no_channel.id[i] = -1;
+	channel_desc.assign( n_febex_sfp * n_febex_board * n_febex_ch, no_channel );
+	
+	for( unsigned int i = 0; i < n_febex_sfp; ++i ){
+		
+		for( unsigned int j = 0; j < n_febex_board; ++j ){
+			
+			for( unsigned int k = 0; k < n_febex_ch; ++k ){
+				
+				ChannelDescriptor &desc = channel_desc[ ( i * n_febex_board + j ) * n_febex_ch + k ];
+				
+				if( mb_cluster[i][j][k] >= 0 ) {
+					
+					desc.type = ChannelDescriptor::DET_MINIBALL;
+					desc.id[0] = mb_cluster[i][j][k];
+					desc.id[1] = mb_crystal[i][j][k];
+					desc.id[2] = mb_segment[i][j][k];
+					
+				}
+				
+				else if( cd_det[i][j][k] >= 0 ) {
+					
+					desc.type = ChannelDescriptor::DET_CD;
+					desc.id[0] = cd_det[i][j][k];
+					desc.id[1] = cd_sector[i][j][k];
+					desc.id[2] = cd_side[i][j][k];
+					desc.id[3] = cd_strip[i][j][k];
+					
+				}
+				
+				else if( bd_det[i][j][k] >= 0 ) {
+					
+					desc.type = ChannelDescriptor::DET_BEAMDUMP;
+					desc.id[0] = bd_det[i][j][k];
+					
+				}
+				
+				else if( spede_seg[i][j][k] >= 0 ) {
+					
+					desc.type = ChannelDescriptor::DET_SPEDE;
+					desc.id[0] = spede_seg[i][j][k];
+					
+				}
+				
+			} // k: febex ch
+			
+		} // j: febex board
+		
+	} // i: febex sfp
+	
+	
 	// Finished
 	delete config;
 	
+	// Keep it all for next time
+	ConfigCache new_cache( fInputFile, Class_Version() );
+	CacheSettings( new_cache );
+	new_cache.Save();
+	
+}
+
+// Pack everything read from the file in to the cache, or unpack it again.
+// Anything added to the settings has to go here too, and the class
+// version has to change so that old caches aren't used.
+void Settings::CacheSettings( ConfigCache &cache ) {
+	
+	// FEBEX and detector sizes
+	cache.Data( n_febex_sfp );
+	cache.Data( n_febex_board );
+	cache.Data( n_febex_ch );
+	cache.Data( n_mb_cluster );
+	cache.Data( n_mb_crystal );
+	cache.Data( n_mb_segment );
+	cache.Data( n_cd_det );
+	cache.Data( n_cd_sector );
+	cache.Data( n_cd_side );
+	cache.Data( n_cd_pstrip );
+	cache.Data( n_cd_nstrip );
+	cache.Data( n_bd_det );
+	cache.Data( n_spede_seg );
+	
+	// Info codes
+	cache.Data( sync_code );
+	cache.Data( thsb_code );
+	cache.Data( pause_code );
+	cache.Data( resume_code );
+	cache.Data( pulser_sfp );
+	cache.Data( pulser_board );
+	cache.Data( pulser_ch );
+	cache.Data( pulser_code );
+	cache.Data( ebis_sfp );
+	cache.Data( ebis_board );
+	cache.Data( ebis_ch );
+	cache.Data( ebis_code );
+	cache.Data( t1_sfp );
+	cache.Data( t1_board );
+	cache.Data( t1_ch );
+	cache.Data( t1_code );
+	
+	// Event builder, data format and time sorting
+	cache.Data( event_window );
+	cache.Data( block_size );
+	cache.Data( flag_febex_only );
+	cache.Data( read_ahead );
+	cache.Data( checkpoint_blocks );
+	cache.Data( sort_memory );
+	cache.Data( sort_dir );
+	cache.Data( sort_window );
+	cache.Data( flag_flat_output );
+	
+	// Electronics mapping
+	cache.Data( mb_sfp );
+	cache.Data( mb_board );
+	cache.Data( mb_ch );
+	cache.Data( mb_cluster );
+	cache.Data( mb_crystal );
+	cache.Data( mb_segment );
+	cache.Data( cd_sfp );
+	cache.Data( cd_board );
+	cache.Data( cd_ch );
+	cache.Data( cd_det );
+	cache.Data( cd_sector );
+	cache.Data( cd_side );
+	cache.Data( cd_strip );
+	cache.Data( bd_sfp );
+	cache.Data( bd_board );
+	cache.Data( bd_ch );
+	cache.Data( bd_det );
+	cache.Data( spede_sfp );
+	cache.Data( spede_board );
+	cache.Data( spede_ch );
+	cache.Data( spede_seg );
+	cache.Data( channel_desc );
+	cache.Data( no_channel );
+	
+	return;
+	
 }
 
 
@@ -325,7 +481,7 @@ bool Settings::IsMiniball( unsigned int sfp, unsigned int board, unsigned int ch
 }
 
 int Settings::GetMiniballID( unsigned int sfp, unsigned int board, unsigned int ch,
-							 std::vector<std::vector<std::vector<int>>> vector ) {
+							 const std::vector<std::vector<std::vector<int>>> &vector ) {
 	
 	/// Return the Miniball ID by the FEBEX SFP, Board number and Channel number
 	if( sfp < n_febex_sfp && board < n_febex_board && ch < n_febex_ch )
@@ -352,7 +508,7 @@ bool Settings::IsCD( unsigned int sfp, unsigned int board, unsigned int ch ) {
 }
 
 int Settings::GetCDID( unsigned int sfp, unsigned int board, unsigned int ch,
-					  std::vector<std::vector<std::vector<int>>> vector ) {
+					  const std::vector<std::vector<std::vector<int>>> &vector ) {
 	
 	/// Return the CD ID by the FEBEX SFP, Board number and Channel number
 	if( sfp < n_febex_sfp && board < n_febex_board && ch < n_febex_ch )
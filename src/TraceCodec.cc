@@ -0,0 +1,114 @@
+#include "TraceCodec.hh"
+
+// Compress nsamples to the end of packed
+void TraceCodec::Encode( const unsigned short *samples, unsigned int nsamples,
+						std::vector<unsigned char> &packed ){
+
+	packed.clear();
+	if( nsamples == 0 ) return;
+	packed.reserve( GetMaxSize( nsamples ) );
+
+	// First sample as it is
+	packed.push_back( samples[0] & 0xFF );
+	packed.push_back( samples[0] >> 8 );
+
+	unsigned int zz[group_size];
+	for( unsigned int i = 1; i < nsamples; i += group_size ) {
+
+		// Differences to the previous sample, zigzag encoded
+		unsigned int n = nsamples - i < group_size ? nsamples - i : group_size;
+		unsigned int all = 0;
+		for( unsigned int j = 0; j < n; ++j ) {
+
+			int diff = (int)samples[i+j] - (int)samples[i+j-1];
+			zz[j] = ( (unsigned int)diff << 1 ) ^ (unsigned int)( diff >> 31 );
+			all |= zz[j];
+
+		}
+
+		// Bits needed for the biggest one
+		unsigned char width = 0;
+		while( all >> width ) width++;
+		packed.push_back( width );
+		if( width == 0 ) continue;
+
+		// Pack them, lowest bits first
+		unsigned long long buffer = 0;
+		unsigned int nbits = 0;
+		for( unsigned int j = 0; j < n; ++j ) {
+
+			buffer |= (unsigned long long)zz[j] << nbits;
+			nbits += width;
+			while( nbits >= 8 ) {
+
+				packed.push_back( buffer & 0xFF );
+				buffer >>= 8;
+				nbits -= 8;
+
+			}
+
+		}
+		if( nbits ) packed.push_back( buffer & 0xFF );
+
+	}
+
+	return;
+
+}
+
+// Uncompress nsamples in to samples, which must be big enough.
+// Returns false if packed is too short or corrupt.
+bool TraceCodec::Decode( const unsigned char *packed, unsigned int nbytes,
+						unsigned short *samples, unsigned int nsamples ){
+
+	if( nsamples == 0 ) return true;
+	if( nbytes < 2 ) return false;
+
+	unsigned int pos = 2;
+	samples[0] = packed[0] | ( packed[1] << 8 );
+
+	for( unsigned int i = 1; i < nsamples; i += group_size ) {
+
+		unsigned int n = nsamples - i < group_size ? nsamples - i : group_size;
+		if( pos >= nbytes ) return false;
+		unsigned char width = packed[pos++];
+		if( width > 17 ) return false;
+
+		// Flat, so all the same as the last one
+		if( width == 0 ) {
+
+			for( unsigned int j = 0; j < n; ++j )
+				samples[i+j] = samples[i-1];
+
+			continue;
+
+		}
+
+		if( pos + ( n * width + 7 ) / 8 > nbytes ) return false;
+
+		unsigned long long buffer = 0;
+		unsigned int nbits = 0;
+		unsigned int mask = ( 1u << width ) - 1;
+		for( unsigned int j = 0; j < n; ++j ) {
+
+			while( nbits < width ) {
+
+				buffer |= (unsigned long long)packed[pos++] << nbits;
+				nbits += 8;
+
+			}
+
+			unsigned int zz = buffer & mask;
+			buffer >>= width;
+			nbits -= width;
+
+			int diff = (int)( zz >> 1 ) ^ -(int)( zz & 1 );
+			samples[i+j] = samples[i+j-1] + diff;
+
+		}
+
+	}
+
+	return true;
+
+}